@@ -9,6 +9,8 @@
 #include <libavutil/avstring.h>
 
 #include <sys/stat.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #define UNSPECIFIED_COLOR_PROPERTIES \
 	.pix_fmt = AV_PIX_FMT_NONE,\
@@ -113,6 +115,38 @@ void ffapi_parse_color_props(FFColorProperties* c, const char* props) {
 	av_dict_free(&d);
 }
 
+int ffapi_parse_threads(FFThreadConfig* t, const char* spec) {
+	*t = (FFThreadConfig){0};
+	if(!spec || !*spec)
+		return 0;
+	char* end = (char*)spec;
+	if(!strncmp(spec,"auto",4))
+		end += 4;
+	else {
+		long count = strtol(spec,&end,10);
+		if(end == spec || count < 0 || count > INT_MAX)
+			return AVERROR(EINVAL);
+		t->count = count;
+	}
+	if(!*end)
+		return 0;
+	if(*end++ != ':')
+		return AVERROR(EINVAL);
+	if(!strcmp(end,"frame"))
+		t->type = FF_THREAD_FRAME;
+	else if(!strcmp(end,"slice"))
+		t->type = FF_THREAD_SLICE;
+	else if(strcmp(end,"auto"))
+		return AVERROR(EINVAL);
+	return 0;
+}
+
+// options parsed afterwards (e.g. threads=n in the option string) still take precedence
+static void set_codec_threads(AVCodecContext* avc, const FFThreadConfig* t) {
+	avc->thread_count = t ? t->count : 0;
+	avc->thread_type = t && t->type ? t->type : FF_THREAD_FRAME|FF_THREAD_SLICE;
+}
+
 #define validate_color_prop(c,ret,prop,strprop,getter) do {\
 	if(!getter(c->prop)) {\
 		av_log(NULL,AV_LOG_ERROR,"ffapi: Invalid " strprop "\n");\
@@ -141,6 +175,14 @@ bool ffapi_pixfmts_8bit_pel(const AVPixFmtDescriptor* desc) {
 	return desc->nb_components && !(desc->flags & (AV_PIX_FMT_FLAG_HWACCEL|AV_PIX_FMT_FLAG_BITSTREAM));
 }
 
+// every component in a 16-bit word of its own, which rules out formats packing several into 32 bits like x2rgb10
+bool ffapi_pixfmts_16bit_pel(const AVPixFmtDescriptor* desc) {
+	for(int c = 0; c < desc->nb_components; c++)
+		if(desc->comp[c].depth <= 8 || desc->comp[c].depth+desc->comp[c].shift > 16 || desc->comp[c].step % 2)
+			return false;
+	return desc->nb_components && !(desc->flags & (AV_PIX_FMT_FLAG_HWACCEL|AV_PIX_FMT_FLAG_BITSTREAM|AV_PIX_FMT_FLAG_FLOAT));
+}
+
 bool ffapi_pixfmts_32_bit_float_pel(const AVPixFmtDescriptor* desc) {
 	for(int c = 0; c < desc->nb_components; c++)
 		if(!((desc->flags & AV_PIX_FMT_FLAG_FLOAT) && desc->comp[c].depth == 32))
@@ -148,9 +190,28 @@ bool ffapi_pixfmts_32_bit_float_pel(const AVPixFmtDescriptor* desc) {
 	return desc->nb_components;
 }
 
+// ring of frames between the caller and a read-ahead or write-behind thread
+// count frames starting at head are ready for the consumer, the rest are free for the producer
+struct ffapi_queue {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t ready, space;
+	AVFrame** frames,* spare;
+	unsigned depth, head, count;
+	int err; // what ended decoding or encoding, returned to the caller once it gets that far
+	atomic_bool stop; // the reader stops right away, the writer once it has drained the ring
+};
+
+// lets ffapi_close break the read-ahead thread out of a blocking read, e.g. on a pipe
+static int interrupt_read(void* opaque) {
+	FFContext* in = opaque;
+	return in->queue && atomic_load(&in->queue->stop);
+}
+
 FFContext* ffapi_open_input(const char* file, const char* options,
                          const char* format, FFColorProperties* color_props, ffapi_pix_fmt_filter* pix_fmt_filter,
-                         uint8_t* components, int (*widths)[4], int (*heights)[4], uint64_t* frames, AVRational* rate, bool calc_frames, int* averror) {
+                         uint8_t* components, int (*widths)[4], int (*heights)[4], uint64_t* frames, AVRational* rate, bool calc_frames,
+                         const FFThreadConfig* threads, int* averror) {
 
 	int err = 0;
 	if(averror)
@@ -171,6 +232,12 @@ FFContext* ffapi_open_input(const char* file, const char* options,
 	if((err = av_dict_parse_string(&opts,options,"=",":",0)))
 		goto error;
 
+	if(!(in->fmt = avformat_alloc_context()) || !(in->packet = av_packet_alloc())) {
+		err = AVERROR(ENOMEM);
+		goto error;
+	}
+	in->fmt->interrupt_callback = (AVIOInterruptCB){ interrupt_read, in };
+
 	if(!strcmp(file,"-"))
 		file = "pipe:";
 	struct stat st;
@@ -202,6 +269,7 @@ FFContext* ffapi_open_input(const char* file, const char* options,
 	}
 	if((err = avcodec_parameters_to_context(avc, params)) < 0)
 		goto error;
+	set_codec_threads(avc,threads);
 	if((err = avcodec_open2(avc,dec,&opts)))
 		goto error;
 
@@ -231,7 +299,7 @@ FFContext* ffapi_open_input(const char* file, const char* options,
 					goto error;
 				}
 				ffapi_close(in);
-				return ffapi_open_input(file,options,format,color_props,pix_fmt_filter,components,widths,heights,NULL,rate,false,averror);
+				return ffapi_open_input(file,options,format,color_props,pix_fmt_filter,components,widths,heights,NULL,rate,false,threads,averror);
 			}
 		}
 	}
@@ -362,7 +430,8 @@ static int ffapi_io_close_pipe(AVFormatContext *s, AVIOContext* pb) {
 FFContext* ffapi_open_output(const char* file, const char* options,
                          const char* format, const char* encoder, enum AVCodecID preferred_encoder,
                          const FFColorProperties* in_color_props,
-                         size_t width, size_t height, AVRational rate, int* averror) {
+                         size_t width, size_t height, AVRational rate,
+                         const FFThreadConfig* threads, int* averror) {
 
 	int err = 0;
 	if(averror)
@@ -370,7 +439,7 @@ FFContext* ffapi_open_output(const char* file, const char* options,
 
 	AVDictionary* opts = NULL;
 	FFContext* out = calloc(1,sizeof(*out));
-	if(!out) {
+	if(!out || !(out->packet = av_packet_alloc())) {
 		err = AVERROR(ENOMEM);
 		goto error;
 	}
@@ -445,6 +514,7 @@ FFContext* ffapi_open_output(const char* file, const char* options,
 	if((err = avcodec_parameters_from_context(out->st->codecpar,avc)) < 0)
 		goto error;
 
+	set_codec_threads(avc,threads);
 	if((err = av_dict_parse_string(&opts,options,"=",":",0)))
 		goto error;
 	if((err = avcodec_open2(avc,enc,&opts)))
@@ -558,17 +628,21 @@ error:
 	return NULL;
 }
 
+static void set_frame_props(FFContext* ctx, AVFrame* frame) {
+	frame->width  = ctx->st->codecpar->width;
+	frame->height = ctx->st->codecpar->height;
+	frame->format = av_pix_fmt_desc_get_id(ctx->pixdesc);
+	frame->color_range = ctx->color_props.color_range;
+	frame->color_primaries = ctx->color_props.color_primaries;
+	frame->color_trc = ctx->color_props.color_trc;
+	frame->colorspace = ctx->color_props.color_space;
+	frame->chroma_location = ctx->color_props.chroma_location;
+}
+
 AVFrame* ffapi_alloc_frame(FFContext* ctx) {
 	AVFrame* frame = av_frame_alloc();
 	if(frame && (ctx->fmt->oformat || ctx->sws)) {
-		frame->width  = ctx->st->codecpar->width;
-		frame->height = ctx->st->codecpar->height;
-		frame->format = av_pix_fmt_desc_get_id(ctx->pixdesc);
-		frame->color_range = ctx->color_props.color_range;
-		frame->color_primaries = ctx->color_props.color_primaries;
-		frame->color_trc = ctx->color_props.color_trc;
-		frame->colorspace = ctx->color_props.color_space;
-		frame->chroma_location = ctx->color_props.chroma_location;
+		set_frame_props(ctx,frame);
 		if(ctx->fmt->oformat && av_frame_get_buffer(frame,1))
 			return NULL;
 	}
@@ -576,12 +650,14 @@ AVFrame* ffapi_alloc_frame(FFContext* ctx) {
 }
 
 int ffapi_seek_frame(FFContext* ctx, uint64_t* offset, void (*progress)(uint64_t)) {
+	if(ctx->queue)
+		return AVERROR(EINVAL);
 	if(!*offset)
 		return 0;
 
 	AVFrame* frame = av_frame_alloc();
 	uint64_t seek;
-	FFContext ctx_copy = (FFContext){ .fmt = ctx->fmt, .codec = ctx->codec, .st = ctx->st };
+	FFContext ctx_copy = (FFContext){ .fmt = ctx->fmt, .codec = ctx->codec, .st = ctx->st, .packet = ctx->packet };
 
 	int err = 0;
 	// just unswitch this manually
@@ -595,6 +671,47 @@ int ffapi_seek_frame(FFContext* ctx, uint64_t* offset, void (*progress)(uint64_t
 	return err;
 }
 
+int ffapi_seek_to_frame(FFContext* ctx, uint64_t target) {
+	if(ctx->queue)
+		return AVERROR(EINVAL);
+	if(!target)
+		return 0;
+
+	AVStream* st = ctx->st;
+	const int64_t start = st->start_time == AV_NOPTS_VALUE ? 0 : st->start_time;
+	FFContext ctx_copy = (FFContext){ .fmt = ctx->fmt, .codec = ctx->codec, .st = ctx->st, .packet = ctx->packet };
+	int err = 0;
+	if(st->r_frame_rate.num && av_seek_frame(ctx->fmt,st->index,start+av_rescale_q(target,av_inv_q(st->r_frame_rate),st->time_base),AVSEEK_FLAG_BACKWARD) >= 0) {
+		AVFrame* frame = av_frame_alloc();
+		if(!frame)
+			return AVERROR(ENOMEM);
+		avcodec_flush_buffers(ctx->codec);
+		// timestamps are compared as frame numbers rounded to the nearest, and the first frame must be at or before the target
+		int64_t n = -1;
+		for(bool first = true; !(err = ffapi_read_frame(&ctx_copy,frame)); first = false) {
+			if(frame->pts == AV_NOPTS_VALUE)
+				break;
+			n = av_rescale_q_rnd(frame->pts-start,st->time_base,av_inv_q(st->r_frame_rate),AV_ROUND_NEAR_INF);
+			if(first && n > (int64_t)target)
+				break;
+			if(n >= (int64_t)target) {
+				ctx->pending = frame;
+				return 0;
+			}
+		}
+		av_frame_free(&frame);
+		if(err)
+			return err;
+
+		// no telling where the seek landed, so go back to the start and count
+		if((err = av_seek_frame(ctx->fmt,st->index,start,AVSEEK_FLAG_BACKWARD)) < 0)
+			return err;
+		avcodec_flush_buffers(ctx->codec);
+	}
+	uint64_t offset = target;
+	return ffapi_seek_frame(ctx,&offset,NULL);
+}
+
 void ffapi_clear_frame(AVFrame* frame) {
 	av_frame_make_writable(frame);
 	for(int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++)
@@ -605,18 +722,25 @@ void ffapi_free_frame(AVFrame* frame) {
 	av_frame_free(&frame);
 }
 
-int ffapi_read_frame(FFContext* in, AVFrame* frame) {
+static int decode_frame(FFContext* in, AVFrame* frame) {
 	AVFrame* readframe = in->sws ? in->swsframe : frame;
+	AVPacket* packet = in->packet;
 	int err = 0;
-	AVPacket* packet = av_packet_alloc();
-	while(!err && (err = avcodec_receive_frame(in->codec, readframe)) == AVERROR(EAGAIN)) {
-		while(!(err = av_read_frame(in->fmt,packet)) && packet->stream_index != in->st->index)
-			av_packet_unref(packet);
-		if(err)
-			err = avcodec_send_packet(in->codec, NULL);
-		else {
-			err = avcodec_send_packet(in->codec, packet);
-			av_packet_unref(packet);
+	if(in->pending) {
+		av_frame_unref(readframe);
+		av_frame_move_ref(readframe,in->pending);
+		av_frame_free(&in->pending);
+	}
+	else {
+		while(!err && (err = avcodec_receive_frame(in->codec, readframe)) == AVERROR(EAGAIN)) {
+			while(!(err = av_read_frame(in->fmt,packet)) && packet->stream_index != in->st->index)
+				av_packet_unref(packet);
+			if(err)
+				err = avcodec_send_packet(in->codec, NULL);
+			else {
+				err = avcodec_send_packet(in->codec, packet);
+				av_packet_unref(packet);
+			}
 		}
 	}
 	if(!err) {
@@ -625,30 +749,154 @@ int ffapi_read_frame(FFContext* in, AVFrame* frame) {
 				err = 0;
 		frame->pts = readframe->best_effort_timestamp;
 	}
-	av_packet_free(&packet);
 	return err;
 }
 
+static void free_queue(struct ffapi_queue* q) {
+	for(unsigned i = 0; q->frames && i < q->depth; i++)
+		av_frame_free(&q->frames[i]);
+	free(q->frames);
+	av_frame_free(&q->spare);
+	pthread_cond_destroy(&q->space);
+	pthread_cond_destroy(&q->ready);
+	pthread_mutex_destroy(&q->lock);
+	free(q);
+}
+
+static int start_queue(FFContext* ctx, unsigned depth, void* (*thread)(void*)) {
+	if(ctx->queue || !depth)
+		return AVERROR(EINVAL);
+
+	struct ffapi_queue* q = calloc(1,sizeof(*q));
+	if(!q)
+		return AVERROR(ENOMEM);
+	pthread_mutex_init(&q->lock,NULL);
+	pthread_cond_init(&q->ready,NULL);
+	pthread_cond_init(&q->space,NULL);
+	atomic_init(&q->stop,false);
+	if(!(q->frames = calloc(depth,sizeof(*q->frames)))) {
+		free_queue(q);
+		return AVERROR(ENOMEM);
+	}
+	q->depth = depth;
+	// output frames come with buffers, decoders fill input frames from their own pools so only sws output needs them up front
+	for(unsigned i = 0; i < depth; i++)
+		if(!(q->frames[i] = ffapi_alloc_frame(ctx)) || (!ctx->fmt->oformat && ctx->sws && av_frame_get_buffer(q->frames[i],0))) {
+			free_queue(q);
+			return AVERROR(ENOMEM);
+		}
+	if(!(q->spare = av_frame_alloc())) {
+		free_queue(q);
+		return AVERROR(ENOMEM);
+	}
+
+	ctx->queue = q;
+	int err;
+	if((err = pthread_create(&q->thread,NULL,thread,ctx))) {
+		ctx->queue = NULL;
+		free_queue(q);
+		return AVERROR(err);
+	}
+	return 0;
+}
+
+static int stop_queue(FFContext* ctx) {
+	struct ffapi_queue* q = ctx->queue;
+	pthread_mutex_lock(&q->lock);
+	atomic_store(&q->stop,true);
+	pthread_cond_signal(&q->space);
+	pthread_cond_signal(&q->ready);
+	pthread_mutex_unlock(&q->lock);
+	pthread_join(q->thread,NULL);
+	int err = q->err;
+	ctx->queue = NULL;
+	free_queue(q);
+	return err;
+}
+
+static void* read_ahead(void* arg) {
+	FFContext* in = arg;
+	struct ffapi_queue* q = in->queue;
+	for(int err = 0; !err;) {
+		pthread_mutex_lock(&q->lock);
+		while(q->count == q->depth && !atomic_load(&q->stop))
+			pthread_cond_wait(&q->space,&q->lock);
+		AVFrame* frame = q->frames[(q->head+q->count)%q->depth];
+		pthread_mutex_unlock(&q->lock);
+		if(atomic_load(&q->stop))
+			break;
+
+		// sws writes into the buffers swapped in from the caller, unless the caller kept a reference to them
+		if(in->sws && frame->buf[0] && !av_frame_is_writable(frame)) {
+			av_frame_unref(frame);
+			set_frame_props(in,frame);
+		}
+		err = decode_frame(in,frame);
+
+		pthread_mutex_lock(&q->lock);
+		if(err)
+			q->err = err;
+		else q->count++;
+		pthread_cond_signal(&q->ready);
+		pthread_mutex_unlock(&q->lock);
+	}
+	return NULL;
+}
+
+int ffapi_read_ahead(FFContext* in, unsigned depth) {
+	if(in->fmt->oformat)
+		return AVERROR(EINVAL);
+	return start_queue(in,depth,read_ahead);
+}
+
+static int take_frame(FFContext* in, AVFrame* frame) {
+	struct ffapi_queue* q = in->queue;
+	int err = 0;
+	pthread_mutex_lock(&q->lock);
+	while(!q->count && !q->err)
+		pthread_cond_wait(&q->ready,&q->lock);
+	if(q->count) {
+		// swapped rather than moved so the caller's old frame goes back into the ring
+		AVFrame* head = q->frames[q->head];
+		av_frame_move_ref(q->spare,frame);
+		av_frame_move_ref(frame,head);
+		av_frame_move_ref(head,q->spare);
+		q->head = (q->head+1)%q->depth;
+		q->count--;
+		pthread_cond_signal(&q->space);
+	}
+	else err = q->err;
+	pthread_mutex_unlock(&q->lock);
+	return err;
+}
+
+int ffapi_read_frame(FFContext* in, AVFrame* frame) {
+	return in->queue ? take_frame(in,frame) : decode_frame(in,frame);
+}
+
 static int flush_frame(FFContext* out) {
 	AVCodecContext* codec = out->codec;
-	AVPacket* packet = av_packet_alloc();
+	AVPacket* packet = out->packet;
 	int err = 0;
 	while(!err && !(err = avcodec_receive_packet(codec,packet))) {
 		av_packet_rescale_ts(packet,codec->time_base,out->st->time_base);
 		packet->stream_index = out->st->index;
 		err = av_write_frame(out->fmt,packet);
 	}
-	av_packet_free(&packet);
+	av_packet_unref(packet);
 	if(err == AVERROR(EOF) || err == AVERROR(EAGAIN))
 		err = 0;
 	return err;
 }
 
-int ffapi_write_frame(FFContext* out, AVFrame* frame) {
+static int encode_frame(FFContext* out, AVFrame* frame) {
 	AVFrame* writeframe;
 	int err;
 	if(out->sws) {
 		writeframe = out->swsframe;
+		// frame threaded encoders can still hold a reference to the last conversion
+		if(writeframe->buf[0] && (err = av_frame_make_writable(writeframe)) < 0)
+			return err;
 		if((err = sws_scale_frame(out->sws,out->swsframe,frame)) < 0)
 			return err;
 	}
@@ -660,6 +908,126 @@ int ffapi_write_frame(FFContext* out, AVFrame* frame) {
 	return flush_frame(out);
 }
 
+static void* write_behind(void* arg) {
+	FFContext* out = arg;
+	struct ffapi_queue* q = out->queue;
+	for(int err = 0; !err;) {
+		pthread_mutex_lock(&q->lock);
+		while(!q->count && !atomic_load(&q->stop))
+			pthread_cond_wait(&q->ready,&q->lock);
+		AVFrame* frame = q->count ? q->frames[q->head] : NULL;
+		pthread_mutex_unlock(&q->lock);
+		if(!frame)
+			break;
+
+		err = encode_frame(out,frame);
+
+		pthread_mutex_lock(&q->lock);
+		q->err = err;
+		q->head = (q->head+1)%q->depth;
+		q->count--;
+		pthread_cond_signal(&q->space);
+		pthread_mutex_unlock(&q->lock);
+	}
+	return NULL;
+}
+
+int ffapi_write_behind(FFContext* out, unsigned depth) {
+	if(!out->fmt->oformat)
+		return AVERROR(EINVAL);
+	return start_queue(out,depth,write_behind);
+}
+
+static int queue_frame(FFContext* out, AVFrame* frame) {
+	struct ffapi_queue* q = out->queue;
+	int err;
+	pthread_mutex_lock(&q->lock);
+	while(q->count == q->depth && !q->err)
+		pthread_cond_wait(&q->space,&q->lock);
+	AVFrame* tail = q->frames[(q->head+q->count)%q->depth];
+	err = q->err;
+	pthread_mutex_unlock(&q->lock);
+	if(err)
+		return err;
+
+	// copied rather than swapped since callers may only redraw part of the frame they keep
+	if((err = av_frame_make_writable(tail)) < 0 || (err = av_frame_copy(tail,frame)) < 0)
+		return err;
+
+	pthread_mutex_lock(&q->lock);
+	q->count++;
+	pthread_cond_signal(&q->ready);
+	pthread_mutex_unlock(&q->lock);
+	return 0;
+}
+
+int ffapi_write_frame(FFContext* out, AVFrame* frame) {
+	if(out->queue)
+		return queue_frame(out,frame);
+	int err = encode_frame(out,frame);
+	// the caller draws the next frame into this one, so it can't share buffers with frames still being encoded
+	if(!err && !out->sws && frame->buf[0])
+		err = av_frame_make_writable(frame);
+	return err;
+}
+
+int ffapi_append(FFContext* out, const char* file) {
+	AVFormatContext* fmt = NULL;
+	AVPacket* packet = NULL;
+	int err;
+	if(out->queue)
+		return AVERROR(EINVAL);
+	if((err = avformat_open_input(&fmt,file,NULL,NULL)))
+		return err;
+	if((err = avformat_find_stream_info(fmt,NULL)) < 0)
+		goto end;
+	int stream = av_find_best_stream(fmt,AVMEDIA_TYPE_VIDEO,-1,-1,NULL,0);
+	if(stream < 0) {
+		err = stream;
+		goto end;
+	}
+	AVStream* st = fmt->streams[stream];
+
+	// the packets have to decode with the parameters already written to the header of out
+	const AVCodecParameters* src = st->codecpar,* dst = out->st->codecpar;
+	if(src->codec_id != dst->codec_id || src->format != dst->format || src->width != dst->width || src->height != dst->height ||
+	   src->extradata_size != dst->extradata_size || (src->extradata_size && memcmp(src->extradata,dst->extradata,src->extradata_size))) {
+		av_log(NULL,AV_LOG_ERROR,"%s wasn't encoded like the output it's appended to\n",file);
+		err = AVERROR(EINVAL);
+		goto end;
+	}
+
+	if(!(packet = av_packet_alloc())) {
+		err = AVERROR(ENOMEM);
+		goto end;
+	}
+	const int64_t offset = out->appended, frame = FFMAX(av_rescale_q(1,av_inv_q(out->st->avg_frame_rate),out->st->time_base),1);
+	while(!(err = av_read_frame(fmt,packet))) {
+		if(packet->stream_index == stream) {
+			av_packet_rescale_ts(packet,st->time_base,out->st->time_base);
+			if(packet->pts != AV_NOPTS_VALUE)
+				packet->pts += offset;
+			if(packet->dts != AV_NOPTS_VALUE)
+				packet->dts += offset;
+			packet->stream_index = out->st->index;
+			int64_t ts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+			if(ts != AV_NOPTS_VALUE)
+				out->appended = FFMAX(out->appended,ts+(packet->duration > 0 ? packet->duration : frame));
+			err = av_write_frame(out->fmt,packet);
+		}
+		av_packet_unref(packet);
+		if(err)
+			break;
+	}
+	if(err == AVERROR_EOF)
+		err = 0;
+
+end:
+	av_packet_free(&packet);
+	avformat_close_input(&fmt);
+	return err;
+}
+
 static int write_end(FFContext* out) {
 	AVCodecContext* codec = out->codec;
 	int err = avcodec_send_frame(codec,NULL);
@@ -676,8 +1044,16 @@ int ffapi_close(FFContext* ctx) {
 		return 0;
 
 	int ret = 0;
+	// a write-behind thread's encoding error may be the first the caller hears of it
+	if(ctx->queue) {
+		int err = stop_queue(ctx);
+		if(ctx->fmt->oformat)
+			ret = err;
+	}
 	if(ctx->fmt && ctx->fmt->oformat) {
-		ret = write_end(ctx);
+		int err = write_end(ctx);
+		if(!ret)
+			ret = err;
 		av_write_trailer(ctx->fmt);
 	}
 	avcodec_free_context(&ctx->codec);
@@ -695,6 +1071,8 @@ int ffapi_close(FFContext* ctx) {
 		else avformat_close_input(&ctx->fmt);
 	}
 
+	av_frame_free(&ctx->pending);
+	av_packet_free(&ctx->packet);
 	free(ctx);
 	return ret;
 }
@@ -11,7 +11,9 @@
 #include <libavutil/pixdesc.h>
 #include <libavutil/parseutils.h>
 #include <libavutil/intreadwrite.h>
+#include <libavutil/avconfig.h>
 #include <stdbool.h>
+#include <string.h>
 
 typedef struct FFColorProperties {
 	enum AVColorRange color_range;
@@ -30,29 +32,55 @@ typedef struct FFContext {
 	struct SwsContext* sws;
 	AVFrame* swsframe;
 	struct FFColorProperties color_props;
+	AVFrame* pending;  // decoded by ffapi_seek_to_frame and returned by the next ffapi_read_frame
+	int64_t appended;  // end timestamp of the packets copied in by ffapi_append
+	AVPacket* packet;  // reused by every read
+	struct ffapi_queue* queue; // set by ffapi_read_ahead or ffapi_write_behind
 } FFContext;
 
+// codec threading for ffapi_open_input/output, a NULL config leaves both fields automatic
+typedef struct FFThreadConfig {
+	int count; // 0 for one thread per core
+	int type;  // FF_THREAD_FRAME and/or FF_THREAD_SLICE, 0 for whichever the codec supports
+} FFThreadConfig;
+
 typedef bool (ffapi_pix_fmt_filter)(const AVPixFmtDescriptor*);
-// pix fmts supported by ffapi_getpel(f)
-ffapi_pix_fmt_filter ffapi_pixfmts_8bit_pel, ffapi_pixfmts_32_bit_float_pel;
+// pix fmts supported by ffapi_getpel(f|16)
+ffapi_pix_fmt_filter ffapi_pixfmts_8bit_pel, ffapi_pixfmts_16bit_pel, ffapi_pixfmts_32_bit_float_pel;
 
 void       ffapi_parse_color_props(FFColorProperties* c, const char* props);
+// parses "count[:frame|slice|auto]" where count may also be "auto", returns AVERROR(EINVAL) on a malformed spec
+int        ffapi_parse_threads(FFThreadConfig* t, const char* spec);
 FFContext* ffapi_open_input (const char* file, const char* options,
                              const char* format, FFColorProperties* color_props, ffapi_pix_fmt_filter*,
                              uint8_t* components, int (*widths)[4], int (*heights)[4], uint64_t* frames,
                              AVRational* rate, bool calc_frames,
-                             int* averror);
+                             const FFThreadConfig* threads, int* averror);
 FFContext* ffapi_open_output(const char* file, const char* options,
                              const char* format, const char* encoder, enum AVCodecID preferred_encoder,
                              const FFColorProperties* in_color_props,
                              size_t width, size_t height, AVRational rate,
-                             int* averror);
+                             const FFThreadConfig* threads, int* averror);
 AVFrame*  ffapi_alloc_frame(FFContext*);
 void      ffapi_free_frame (AVFrame*);
 void      ffapi_clear_frame(AVFrame*);
 int       ffapi_read_frame (FFContext*, AVFrame*);
+// demux, decode and convert on a background thread into a ring of depth preallocated frames, which ffapi_read_frame
+// then swaps with the caller's frame; seek first, since the seek functions return AVERROR(EINVAL) once it's running
+#define   FFAPI_READ_AHEAD 4
+int       ffapi_read_ahead (FFContext*, unsigned depth);
 int       ffapi_seek_frame (FFContext*, uint64_t* offset, void (*progress)(uint64_t));
+// seek to a frame number using the container index, decoding only from the keyframe before it
+// falls back to decoding every frame from the start when the input can't seek or lacks timestamps
+int       ffapi_seek_to_frame(FFContext*, uint64_t frame);
 int       ffapi_write_frame(FFContext*, AVFrame*);
+// convert, encode and mux on a background thread from a ring of depth preallocated frames that ffapi_write_frame
+// copies into, blocking only while the ring is full; encoding errors are returned by later writes or ffapi_close
+#define   FFAPI_WRITE_BEHIND 4
+int       ffapi_write_behind(FFContext*, unsigned depth);
+// copy the video packets of file, encoded with the same parameters as out, onto the end of out without decoding them
+// for joining outputs written in pieces, frames written with ffapi_write_frame don't mix with these
+int       ffapi_append(FFContext* out, const char* file);
 int       ffapi_close(FFContext*);
 
 #define FFA_PEL(frame,comp,x,y) frame->data[comp.plane][y*frame->linesize[comp.plane]+x*comp.step+comp.offset]
@@ -84,6 +112,94 @@ static inline float ffapi_getpelf(FFContext* ctx, AVFrame* frame, size_t x, size
 	}.f;
 }
 
+// 16-bit pel accessors, for components of 9 to 16 bits each held in a 16-bit word
+// values are right-aligned, so range from 0 to 2^depth-1 whatever the format's shift
+static inline void ffapi_setpel16(FFContext* ctx, AVFrame* frame, size_t x, size_t y, uint8_t c, uint16_t val) {
+	AVComponentDescriptor comp = ctx->pixdesc->comp[c];
+	uint8_t* data = &FFA_PEL(frame,comp,x,y);
+	if(ctx->pixdesc->flags & AV_PIX_FMT_FLAG_BE)
+		AV_WB16(data,val << comp.shift);
+	else
+		AV_WL16(data,val << comp.shift);
+}
+
+static inline uint16_t ffapi_getpel16(FFContext* ctx, AVFrame* frame, size_t x, size_t y, uint8_t c) {
+	AVComponentDescriptor comp = ctx->pixdesc->comp[c];
+	uint8_t* data = &FFA_PEL(frame,comp,x,y);
+	return (ctx->pixdesc->flags & AV_PIX_FMT_FLAG_BE ? AV_RB16(data) : AV_RL16(data)) >> comp.shift;
+}
+
+// row accessors for n consecutive pels starting at x,y, with the descriptor and byte order resolved once per row
+// rows of packed pels in native byte order are copied straight through
+static inline void ffapi_getrow_direct(AVFrame* frame, size_t x, size_t y, AVComponentDescriptor comp, unsigned char* restrict dst, size_t n) {
+	const uint8_t* restrict src = &FFA_PEL(frame,comp,x,y);
+	if(comp.step == 1)
+		memcpy(dst,src,n);
+	else for(size_t i = 0; i < n; i++)
+		dst[i] = src[i*comp.step];
+}
+static inline void ffapi_setrow_direct(AVFrame* frame, size_t x, size_t y, AVComponentDescriptor comp, const unsigned char* restrict src, size_t n) {
+	uint8_t* restrict dst = &FFA_PEL(frame,comp,x,y);
+	if(comp.step == 1)
+		memcpy(dst,src,n);
+	else for(size_t i = 0; i < n; i++)
+		dst[i*comp.step] = src[i];
+}
+
+static inline void ffapi_getrowf(FFContext* ctx, AVFrame* frame, size_t x, size_t y, uint8_t c, float* restrict dst, size_t n) {
+	AVComponentDescriptor comp = ctx->pixdesc->comp[c];
+	const uint8_t* restrict src = &FFA_PEL(frame,comp,x,y);
+	bool be = ctx->pixdesc->flags & AV_PIX_FMT_FLAG_BE;
+	if(comp.step == sizeof(float) && be == AV_HAVE_BIGENDIAN)
+		memcpy(dst,src,n*sizeof(float));
+	else if(be)
+		for(size_t i = 0; i < n; i++)
+			dst[i] = (union { uint32_t u; float f; }){AV_RB32(src+i*comp.step)}.f;
+	else
+		for(size_t i = 0; i < n; i++)
+			dst[i] = (union { uint32_t u; float f; }){AV_RL32(src+i*comp.step)}.f;
+}
+static inline void ffapi_setrowf(FFContext* ctx, AVFrame* frame, size_t x, size_t y, uint8_t c, const float* restrict src, size_t n) {
+	AVComponentDescriptor comp = ctx->pixdesc->comp[c];
+	uint8_t* restrict dst = &FFA_PEL(frame,comp,x,y);
+	bool be = ctx->pixdesc->flags & AV_PIX_FMT_FLAG_BE;
+	if(comp.step == sizeof(float) && be == AV_HAVE_BIGENDIAN)
+		memcpy(dst,src,n*sizeof(float));
+	else if(be)
+		for(size_t i = 0; i < n; i++)
+			AV_WB32(dst+i*comp.step,(union { float f; uint32_t u; }){src[i]}.u);
+	else
+		for(size_t i = 0; i < n; i++)
+			AV_WL32(dst+i*comp.step,(union { float f; uint32_t u; }){src[i]}.u);
+}
+
+static inline void ffapi_getrow16(FFContext* ctx, AVFrame* frame, size_t x, size_t y, uint8_t c, uint16_t* restrict dst, size_t n) {
+	AVComponentDescriptor comp = ctx->pixdesc->comp[c];
+	const uint8_t* restrict src = &FFA_PEL(frame,comp,x,y);
+	bool be = ctx->pixdesc->flags & AV_PIX_FMT_FLAG_BE;
+	if(comp.step == sizeof(uint16_t) && !comp.shift && be == AV_HAVE_BIGENDIAN)
+		memcpy(dst,src,n*sizeof(uint16_t));
+	else if(be)
+		for(size_t i = 0; i < n; i++)
+			dst[i] = AV_RB16(src+i*comp.step) >> comp.shift;
+	else
+		for(size_t i = 0; i < n; i++)
+			dst[i] = AV_RL16(src+i*comp.step) >> comp.shift;
+}
+static inline void ffapi_setrow16(FFContext* ctx, AVFrame* frame, size_t x, size_t y, uint8_t c, const uint16_t* restrict src, size_t n) {
+	AVComponentDescriptor comp = ctx->pixdesc->comp[c];
+	uint8_t* restrict dst = &FFA_PEL(frame,comp,x,y);
+	bool be = ctx->pixdesc->flags & AV_PIX_FMT_FLAG_BE;
+	if(comp.step == sizeof(uint16_t) && !comp.shift && be == AV_HAVE_BIGENDIAN)
+		memcpy(dst,src,n*sizeof(uint16_t));
+	else if(be)
+		for(size_t i = 0; i < n; i++)
+			AV_WB16(dst+i*comp.step,src[i] << comp.shift);
+	else
+		for(size_t i = 0; i < n; i++)
+			AV_WL16(dst+i*comp.step,src[i] << comp.shift);
+}
+
 #define ffapi_setpel(FFContext,AVFrame,x,y,c,val) ffapi_setpel_direct(AVFrame,x,y,FFContext->pixdesc->comp[c],val)
 #define ffapi_getpel(FFContext,AVFrame,x,y,c) ffapi_getpel_direct(AVFrame,x,y,FFContext->pixdesc->comp[c])
 #define ffapi_setpixel(FFContext,AVFrame,x,y,val)\
@@ -5,12 +5,22 @@
 #include <fftw3.h>
 #include <getopt.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <errno.h>
+#include <float.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <libavutil/eval.h>
 #include <libavutil/csp.h>
 
 #include "ffapi.h"
 #include "precision.h"
 #include "keyed_enum.h"
+#include "motion_pool.h"
+#include "motion_expr.h"
+#include "motion_dct.h"
 
 #define MIN(x,y) ((x) < (y) ? (x) : (y))
 #define MAX(x,y) ((x) > (y) ? (x) : (y))
@@ -30,12 +40,24 @@
 	X(T,dc)\
 	X(T,grey)
 
+#define dcttype(X,T)\
+	X(T,auto)\
+	X(T,fftw)\
+	X(T,fixed)\
+	X(T,int)
+
+#define streamtype(X,T)\
+	X(T,truncate)\
+	X(T,pad)
+
 enum_gen(spectype)
 enum_gen(ispectype)
 enum_gen(preserve_dctype)
+enum_gen(dcttype)
+enum_gen(streamtype)
 
 static bool ffapi_pixfmts_8bit_or_float_pel(const AVPixFmtDescriptor* desc) {
-	return ffapi_pixfmts_8bit_pel(desc) || ffapi_pixfmts_32_bit_float_pel(desc);
+	return ffapi_pixfmts_8bit_pel(desc) || ffapi_pixfmts_16bit_pel(desc) || ffapi_pixfmts_32_bit_float_pel(desc);
 }
 
 static bool pixfmts_8bit_or_float_rgb_or_gray(const AVPixFmtDescriptor* desc) {
@@ -46,9 +68,32 @@ static bool pixfmts_float_rgb_or_gray(const AVPixFmtDescriptor* desc) {
 	return ((desc->flags & AV_PIX_FMT_FLAG_RGB) || desc->nb_components == 1) && ffapi_pixfmts_32_bit_float_pel(desc);
 }
 
-static int sortcoeffs(const void* left, const void* right) {
-	coeff cmp = mc(fabs)(**(coeff**)right) - mc(fabs)(**(coeff**)left);
-	return cmp < 0 ? -1 : (cmp > 0 ? 1 : 0);
+// partially order coeffs so that the k with the largest magnitudes come first
+static void select_coeffs(coeff** coeffs, ptrdiff_t n, ptrdiff_t k) {
+	#define SWAP(a,b) do { coeff* t = coeffs[a]; coeffs[a] = coeffs[b]; coeffs[b] = t; } while(0)
+	ptrdiff_t lo = 0, hi = n-1;
+	while(lo < hi) {
+		ptrdiff_t mid = lo + (hi-lo)/2;
+		// median of three pivot, also serving as sentinels for the scans below
+		if(mc(fabs)(*coeffs[mid]) > mc(fabs)(*coeffs[lo])) SWAP(mid,lo);
+		if(mc(fabs)(*coeffs[hi]) > mc(fabs)(*coeffs[lo])) SWAP(hi,lo);
+		if(mc(fabs)(*coeffs[hi]) > mc(fabs)(*coeffs[mid])) SWAP(hi,mid);
+		coeff pivot = mc(fabs)(*coeffs[mid]);
+		ptrdiff_t l = lo, r = hi;
+		while(l <= r) {
+			while(mc(fabs)(*coeffs[l]) > pivot) l++;
+			while(mc(fabs)(*coeffs[r]) < pivot) r--;
+			if(l <= r) {
+				SWAP(l,r);
+				l++;
+				r--;
+			}
+		}
+		if(k <= r) hi = r;
+		else if(k >= l) lo = l;
+		else break;
+	}
+	#undef SWAP
 }
 
 static void seek_progress(uint64_t seek) {
@@ -79,6 +124,23 @@ static void limit_coords(const coords src, coords dest) {
 		if(src->d < dest->d) dest->d = src->d;
 	}
 }
+// the smallest size of at least n with no prime factors above 7, which FFTW transforms without its slow general-size algorithms
+static uint64_t smooth_size(uint64_t n) {
+	for(;; n++) {
+		uint64_t r = n;
+		for(int p = 2; p <= 7; p++)
+			while(r > 1 && r % p == 0)
+				r /= p;
+		if(r <= 1)
+			return n;
+	}
+}
+// scale coordinates in a block of size from to one of size to
+static void rescale_coords(struct coords* c, struct coords from, struct coords to) {
+	c->w = (c->w*to.w+from.w/2)/from.w;
+	c->h = (c->h*to.h+from.h/2)/from.h;
+	c->d = (c->d*to.d+from.d/2)/from.d;
+}
 #define match_planes(left,right) (left.w == right.w && left.h == right.h && left.d == right.d)
 
 #define print_coords(x) do {\
@@ -89,6 +151,17 @@ for(int i1 = 0; i1 < components; i1++)\
 for(int i1 = 0; i1 < components; i1++)\
 	fprintf(stderr,"%" PRIu64 "%s",x[i1].d,i1 == components -1? "\n" : ":");\
 } while(0)
+// for sizes with no known depth, which an unbounded --stream has
+#define print_area(x) do {\
+for(int i1 = 0; i1 < components; i1++)\
+	fprintf(stderr,"%" PRIu64 "%s",x[i1].w,i1 == components -1? " x " : ":");\
+for(int i1 = 0; i1 < components; i1++)\
+	fprintf(stderr,"%" PRIu64 "%s",x[i1].h,i1 == components -1? "\n" : ":");\
+} while(0)
+// bdepth for expressions, which is NAN when an unbounded --stream leaves the number of temporal blocks unknown
+static double block_depth(uint64_t nblocks) {
+	return nblocks == UINT64_MAX ? NAN : nblocks;
+}
 
 int parse_fftw_flag(const char* arg) {
 	if(!strcasecmp(arg,"estimate"))
@@ -106,8 +179,8 @@ static void usage() {
 	fprintf(stderr,"Usage: motion [options] <infile> [outfile]\n"
 	               "[-s|--size WxHxD] [-b|--blocksize WxHxD] [-p|--bandpass X1xY1xZ1-X2xY2xZ2]\n"
 	               "[-B|--boost float] [-D|--damp float]  [--spectrogram=type] [--ispectrogram=type] [-q|--quant quant] [--threshold] [--coeff-limit limit] [--quant-float params] [-d|--dither] [--preserve-dc=type] [--eval expression]\n"
-	               "[--fftw-planning-method method] [--fftw-wisdom-file file] [--fftw-threads nthreads]\n"
-	               "[-r|--framerate] [--keep-rate] [--samesize-chroma] [--frames lim] [--offset pos] [--csp|c colorspace options] [--iformat|--format fmt] [--codec codec] [--encopts|--decopts opts] [--loglevel int]\n"
+	               "[--fftw-planning-method method] [--fftw-wisdom-file file] [--fftw-threads nthreads] [--fftw-pad] [--threads nthreads] [--pipeline] [--batch] [--out-of-core dir] [--ram-budget MiB] [--incremental] [--dct engine] [--coeff-cache dir] [--output file] [--segments n] [--checkpoint dir] [--checkpoint-interval n] [--resume] [--stream[=type]] [--static-tolerance pels]\n"
+	               "[-r|--framerate] [--keep-rate] [--samesize-chroma] [--frames lim] [--offset pos] [--csp|c colorspace options] [--iformat|--format fmt] [--codec codec] [--encopts|--decopts opts] [--codec-threads n[:type]] [--loglevel int]\n"
 	               "[-Q|--quiet]\n");
 	exit(1);
 }
@@ -116,6 +189,8 @@ static void help() {
 	printf("Usage: motion [options] <infile> [outfile]\n"
 	"\n"
 	"  <outfile>               Output file or pipe, or \"ffplay:\" for ffplay output. If no output file is given motion prints the input dimensions and exits.\n"
+	"  --output <file>         Write another output from the same forward transform. The operations given after it (--bandpass, --boost, --damp, --spectrogram, --quant, --threshold, --coeff-limit, --dither, --preserve-dc, --eval) apply to it alone, starting from those given before the first --output, which apply to <outfile>.\n"
+	"                          With a spectrogram among the outputs every output is processed in a pixel format suiting it. Cannot be used with --pipeline, --batch, --out-of-core, --incremental, or --dct int.\n"
 	"\n"
 	"  -h, --help              This help text.\n"
 	"  -Q, --quiet             Silence progress and other non-error output.\n"
@@ -143,6 +218,25 @@ static void help() {
 	"  --fftw-planning-method <m>  How thoroughly to plan the transform: estimate (default), measure, patient, exhaustive. Higher values trade startup time for transform time.\n"
 	"  --fftw-wisdom-file <file>   File to read accumulated FFTW plan wisdom from and save new wisdom to. Can be used to save startup time for higher planning methods for repeat block sizes.\n"
 	"  --fftw-threads <num>        Maximum number of threads to use for FFTW. [default: 1]\n"
+	"  --fftw-pad                  Transform blocks at the next size along each axis with no prime factors above 7, which FFTW is much faster with, extending the pels symmetrically to fill it and cropping the result.\n"
+	"                              The bandpass is scaled to the padded size. Cannot be used with --size, --spectrogram, --ispectrogram, --out-of-core, --incremental, or --dct int.\n"
+	"  --threads <num>             Number of threads to transform independent blocks with. [default: 1]\n"
+	"  --checkpoint <dir>          Encode the output into segment files in dir, each finished after --checkpoint-interval temporal blocks, so a run that's cut short can be picked up again with --resume. The segments are joined into the output and removed at the end.\n"
+	"                              Requires an intra-only encoder such as the default FFV1. Cannot be used with --pipeline, --out-of-core, --incremental, --output, --segments, --stream, or --coeff-cache.\n"
+	"  --checkpoint-interval <num> Number of temporal blocks per checkpoint segment. [default: 1]\n"
+	"  --resume                    Continue the run checkpointed in the --checkpoint dir from its first unfinished segment, seeking the input there. The options that determine the output have to match those it was started with, in any order or spelling.\n"
+	"  --segments <num>            Split the temporal blocks into this many contiguous runs, each decoded, transformed, and encoded on its own thread into a temporary file in $TMPDIR, joined into the output without re-encoding at the end.\n"
+	"                              --threads applies within each segment. Requires a seekable input and an intra-only encoder such as the default FFV1. Cannot be used with --pipeline, --out-of-core, --incremental, or --output.\n"
+	"  --pipeline                  Decode, transform, and encode consecutive temporal blocks concurrently. Uses memory for 3 temporal blocks of pixels.\n"
+	"  --batch                     Transform each row of blocks with a single FFTW plan instead of block by block.\n"
+	"  --static-tolerance <pels>   Transform blocks whose frames all differ from their first by at most this many 8-bit pel levels as a single frame, and repeat the result, dropping the small temporal changes. 0 only matches identical frames.\n"
+	"                              Cannot be used with --ispectrogram, --batch, --out-of-core, --incremental, or --dct int.\n"
+	"  --out-of-core <dir>         Keep transformed frames in a scratch file in dir instead of memory, for temporal blocks too large to fit. Cannot be used with --size, --coeff-limit, --pipeline, --batch, or spectrograms.\n"
+	"  --ram-budget <MiB>          Memory to use for the temporal transform with --out-of-core. [default: 256]\n"
+	"  --incremental               Accumulate only the temporal coefficients below the end of the bandpass as frames are read, instead of holding the whole temporal block. Requires --damp 0. Cannot be used with --size, --coeff-limit, --pipeline, --batch, --out-of-core, or spectrograms.\n"
+	"  --dct <engine>              Transform engine for blocks that aren't resized: auto (default), fftw, fixed, int. auto uses the built-in fixed-size kernels when every dimension of the block is 1, 2, 4, 8, or 16 and they match FFTW. fixed cannot be used with --out-of-core or --incremental.\n"
+	"                              int is a reversible integer transform for 8-bit input that reconstructs it exactly without --quant. It only supports --quant and the same block sizes as fixed.\n"
+	"  --coeff-cache <dir>         Keep the forward transformed blocks in a file in dir, keyed by the input file and the options that determine them. Later runs that only change the operations on the coefficients read them from there instead of decoding and transforming the input. Cannot be used with --ispectrogram, --batch, --out-of-core, --incremental, or --dct int.\n"
 	"\n"
 	"  -r, --framerate <rate>  Set the output framerate to this number or fraction (default: the input framerate).\n"
 	"  --keep-rate             If scaling in time with -s, retain the input framerate instead of scaling the framerate to retain the total duration. Ignored if --framerate is set.\n"
@@ -150,6 +244,9 @@ static void help() {
 	"\n"
 	"  --frames <limit>        Limit the number of output frames.\n"
 	"  --offset <pos>          Seek to this frame number in the input before processing.\n"
+	"  --stream[=<type>]       Read the input as a stream of unknown length, like a pipe, transforming each temporal block as it fills and finishing at the end of the input instead of counting its frames first.\n"
+	"                          Type: what to do with a last temporal block the input ends partway through, %s. pad repeats its last frame to fill it and writes only the frames it had. [default: truncate]\n"
+	"                          Requires a nonzero temporal block size. Cannot be used with --pipeline, --out-of-core, --incremental, --coeff-cache, or --segments.\n"
 	"\n"
 	"  --linear                Process in linear light.\n"
 	"  -c, --csp <optstring>   Option string specifying the pixel format and color properties to convert to for processing.\n"
@@ -159,34 +256,1595 @@ static void help() {
 	"  --codec <enc>           FFmpeg output encoder name. [default: FFV1 or selected by FFmpeg based on output format]\n"
 	"  --encopts <optstring>   Option string containing FFmpeg encoder options for the output file.\n"
 	"  --decopts <optstring>   Option string containing FFmpeg decoder options for the input file.\n"
+	"  --codec-threads <n[:type]>\n"
+	"                          Threads for FFmpeg decoding and encoding, with type one of frame, slice, or auto. [default: auto:auto (one per core)]\n"
 	"  --loglevel <int>        Integer FFmpeg log level. [default: 16 (AV_LOG_ERROR)]\n",
 	enum_keys(spectype),
 	enum_keys(ispectype),
-	enum_keys(preserve_dctype)
+	enum_keys(preserve_dctype),
+	enum_keys(streamtype)
 	);
 	exit(0);
 }
 
+struct motion_nonzero {
+	coeff c;
+	int x, y;
+	uint64_t z;
+};
+
+struct motion_worker {
+	coeff* coeffs,* dc;
+	int32_t* ints;
+	coeff** topcoeffs;
+	struct motion_nonzero* nonzero;
+	// with several outputs, the active region of the forward transformed block each of them starts from
+	coeff* packed;
+	AVExpr* expr;
+	double* exprrow,* exprscratch;
+	void* pels;
+	unsigned long long coeffs_coded, static_blocks;
+};
+
+struct motion_context {
+	uint8_t components;
+	const AVPixFmtDescriptor* pixdesc;
+	coords block, scaled, minbuf, active, nblocks;
+	// the pels of a block read from and written to the frames, the same as block and scaled unless --fftw-pad
+	// made those larger, when the pels are extended to fill the block and the output is cropped back
+	coords pelblock, pelscaled;
+	size_t mincomponent;
+	bool float_pixels, linear, dithering;
+	// with 9- to 16-bit formats pels are uint16_t from 0 to pelmax[i], scaled to and from the 0-255 of 8-bit pels
+	bool deep_pixels;
+	intermediate pelmax[4];
+	size_t pelsize;
+	enum spectype spec;
+	enum ispectype ispec;
+	enum preserve_dctype preserve_dc;
+	av_csp_trc_function input_trc, output_trc;
+	range bandpass;
+	coeff boost[4], damp[4];
+	intermediate quant;
+	coeff threshold_max;
+	size_t coeff_limit;
+	bool batch;
+	fftw(plan) planforward[4], planinverse[4];
+	// when resizing, separate 1D passes per axis that skip the rows outside active, used instead of planforward/planinverse when set
+	fftw(plan) pruneforward[4][3], pruneinverse[4][3];
+	// blocks transformed by the built-in fixed-size kernels instead of FFTW
+	bool fixed[4];
+	// with --static-tolerance blocks whose frames all match their first within it are transformed as a single frame
+	// by these (or the fixed-size kernels), negative when off
+	intermediate static_tolerance;
+	fftw(plan) staticforward[4], staticinverse[4];
+	// with --dct int every block goes through the reversible integer transform and quantization alone
+	bool intdct;
+
+	// with --coeff-cache the forward transformed active region of every block is kept in a file, stride coeffs per temporal
+	// block with component i starting at offset[i]; when hit the file was complete and blocks are read from it instead
+	struct {
+		coeff* map;
+		size_t len, maplen, stride, offset[4];
+		bool hit;
+		char* path,* tmppath;
+	} cache;
+
+	// blocks with at most sparse[i] nonzero coeffs left after filtering are synthesized directly as a sum of basis functions
+	// basis[i][axis] holds the REDFT01 basis, (k ? 2 : 1)*cos(pi*k*(j+0.5)/n) at [k*n+j] for k in active and j in scaled
+	size_t sparse[4];
+	coeff* basis[4][3];
+	intermediate scalefactor[4], normalization[4], c[4], ic[4];
+	coeff quantizer[4], threshold[4][2];
+
+	// per-component x profiles of the operators, the y and z factors are applied per row
+	// gain[i][1] is used for rows within the bandpass and gain[i][0] for the rest
+	// when fused the forward normalization is folded into gain
+	bool fused;
+	coeff* gain[4][2],* forward[4],* inverse[4];
+
+	// --eval compiled to evaluate a row at a time, NULL when it needs av_expr_eval
+	struct motion_expr* compiled_expr;
+	// when --eval is affine in c and independent of the block position it's reduced to c*gain+offset over the active region
+	coeff* exprgain[4],* exproffset[4];
+
+	// with --out-of-core the 2D transformed frames of the current temporal block are kept in a memory-mapped scratch file
+	// plane[i] coeffs per frame for component i, starting at offset[i]
+	struct {
+		coeff* map;
+		size_t len, plane[4], offset[4], tile;
+		fftw(plan) temporal[2];
+	} ooc;
+
+	// with --incremental the first nbands temporal coefficients of the current temporal block are accumulated frame by frame
+	// laid out like the --out-of-core scratch file, with forward/inverse[z*nbands+k] the temporal DCT weights of frame z
+	struct {
+		coeff* bands;
+		size_t len, plane[4], offset[4];
+		uint64_t nbands;
+		coeff* forward,* inverse;
+	} incremental;
+
+	struct motion_pool* pool;
+	struct motion_worker* workers;
+
+	// with --output, the contexts of the outputs after the first, sharing the transforms but with their own operations,
+	// workers, and pixels that every block's forward transform is filtered and inverted into
+	struct motion_context* extra;
+	int nextra;
+
+	// current temporal block
+	uint64_t bz;
+	void*** pixels;
+
+	// with --stream=pad a temporal block cut short by the end of the input is filled out with its last frame,
+	// and tail is the number of frames it really had so only the frames they scale to are written
+	enum streamtype stream;
+	uint64_t tail;
+
+	// current frame, for the modes that work a frame at a time
+	FFContext* framectx;
+	AVFrame* frame;
+	uint64_t z;
+
+	struct {
+		pthread_mutex_t lock;
+		bool quiet;
+		int padb, pads;
+		uint64_t read, wrote;
+	} progress;
+};
+
+// an output file and the frequency-domain operations producing it, from the options following its --output
+struct motion_output {
+	const char* file;
+	FFContext* ctx;
+	AVFrame* frame;
+	enum spectype spec;
+	enum preserve_dctype preserve_dc;
+	range bandpass;
+	coeff boost[4], damp[4];
+	intermediate quant;
+	coeff threshold_min, threshold_max;
+	size_t coeff_limit;
+	bool dithering;
+	const char* exprstr;
+	AVExpr* expr;
+};
+
+static const char* const expr_names[] = {"c","x","y","z","i","width","height","depth","components","bx","by","bz","bwidth","bheight","bdepth",NULL};
+
+static size_t block_jobs(const struct motion_context* m, bool rows) {
+	size_t njobs = 0;
+	for(int i = 0; i < m->components; i++)
+		if(m->bz < m->nblocks[i].d)
+			njobs += rows ? m->nblocks[i].h : m->nblocks[i].w * m->nblocks[i].h;
+	return njobs;
+}
+
+// convert a w x h slice of pixels to the input of the forward transform
+static void load_slice(const struct motion_context* m, int i, const void* pslice, coeff* cslice, int w, int h, size_t stride) {
+	const intermediate normalization = m->normalization[i], pelscale = m->deep_pixels ? 255/m->pelmax[i] : 1;
+	for(int y = 0; y < h; y++)
+		for(int x = 0; x < w; x++) {
+			intermediate pel;
+			if(m->float_pixels)
+				pel = ((float*)pslice)[y*stride+x]*255;
+			else if(m->deep_pixels)
+				pel = ((uint16_t*)pslice)[y*stride+x]*pelscale;
+			else
+				pel = ((unsigned char*)pslice)[y*stride+x];
+
+			switch(m->ispec) {
+				case ispectype_shift: pel = mi(copysign)((mi(expm1)(mi(fabs)((pel-mi(127.5))/m->ic[i]))),pel-mi(127.5))/normalization; break;
+				case ispectype_flat:  pel = (pel-mi(127.5))*2/normalization/normalization; break;
+				case ispectype_copy:  pel = pel/normalization/normalization; break;
+				case ispectype_none:
+					if(m->linear)
+						pel = m->input_trc(pel/255)*255;
+					break;
+			}
+
+			cslice[y*stride+x] = pel;
+		}
+}
+
+static inline uint64_t mirror(uint64_t x, uint64_t n) {
+	x %= 2*n;
+	return x < n ? x : 2*n-1-x;
+}
+
+// fill out a block of coeffs from the pels in its corner, reflected about each edge like the even extension of REDFT10
+static void extend_block(coeff* coeffs, struct coords pels, struct coords block, struct coords minbuf) {
+	const size_t slice = minbuf.w*minbuf.h;
+	for(uint64_t z = 0; z < pels.d; z++) {
+		for(int y = 0; y < pels.h; y++) {
+			coeff* row = coeffs+z*slice+y*minbuf.w;
+			for(uint64_t x = pels.w; x < block.w; x++)
+				row[x] = row[mirror(x,pels.w)];
+		}
+		for(uint64_t y = pels.h; y < block.h; y++)
+			memcpy(coeffs+z*slice+y*minbuf.w,coeffs+z*slice+mirror(y,pels.h)*minbuf.w,sizeof(coeff)*block.w);
+	}
+	for(uint64_t z = pels.d; z < block.d; z++)
+		memcpy(coeffs+z*slice,coeffs+mirror(z,pels.d)*slice,sizeof(coeff)*slice);
+}
+
+static void load_block(const struct motion_context* m, int i, const void* pblock, coeff* coeffs, size_t len) {
+	const struct coords block = m->block[i], pels = m->pelblock[i], minbuf = m->minbuf[i];
+	const size_t pelsize = m->pelsize;
+	memset(coeffs,0,sizeof(coeff)*len);
+	for(uint64_t z = 0; z < pels.d; z++)
+		load_slice(m,i,(const char*)pblock+z*minbuf.h*minbuf.w*pelsize,coeffs+z*minbuf.h*minbuf.w,pels.w,pels.h,minbuf.w);
+	if(!match_planes(block,pels))
+		extend_block(coeffs,pels,block,minbuf);
+}
+
+static inline coeff row_forward(const struct motion_context* m, int y, uint64_t z) {
+	return m->ispec ? 1 : 2*P_SQRT2i / ((y ? 1 : P_SQRT2i) * (z ? 1 : P_SQRT2i));
+}
+
+static inline coeff row_inverse(const struct motion_context* m, int y, uint64_t z) {
+	return m->spec ? 1 : ((y ? 1 : P_SQRT2i) * (z ? 1 : P_SQRT2i)) / (2*P_SQRT2i);
+}
+
+static inline coeff threshold_coeff(const struct motion_context* m, int i, coeff c) {
+	if(m->threshold_max && (mc(fabs)(c) < m->threshold[i][0] || mc(fabs)(c) > m->threshold[i][1]))
+		return 0;
+	return c;
+}
+
+static inline coeff quant_coeff(const struct motion_context* m, int i, coeff c, unsigned long long* coded) {
+	if(m->quant) {
+		c = mi(round)(c / m->quantizer[i])*m->quantizer[i];
+		*coded += !!c;
+	}
+	return c;
+}
+
+// the filtered dc coefficient c, replaced or adjusted according to --preserve-dc
+static inline coeff preserve_dc(const struct motion_context* m, const struct motion_worker* w, int i, coeff c, coeff dc) {
+	const struct coords bp_begin = m->bandpass.begin[i];
+	if(m->preserve_dc) {
+		bool dcstop = bp_begin.d || bp_begin.h || bp_begin.w;
+		if(w->expr || dcstop || m->boost[i] != 1 || m->threshold_max) {
+			if(m->preserve_dc == preserve_dctype_dc)
+				c = dc;
+			else if(m->preserve_dc == preserve_dctype_grey)
+				c += (1-(dcstop ? m->damp[i] : m->boost[i])) * mi(127.5)/(m->normalization[i]*m->normalization[i]*m->scalefactor[i]);
+		}
+	}
+	return c;
+}
+
+// gain, threshold, quantize, and denormalize one row of coefficients in a single pass
+static unsigned long long filter_row(const struct motion_context* m, int i, coeff* restrict row, int begin, int end, const coeff* restrict gain, coeff rowgain, coeff rowinverse) {
+	const coeff* restrict inverse = m->inverse[i];
+	unsigned long long coded = 0;
+	for(int x = begin; x < end; x++)
+		row[x] = quant_coeff(m,i,threshold_coeff(m,i,row[x]*rowgain*gain[x]),&coded)*rowinverse*inverse[x];
+	return coded;
+}
+
+// apply the frequency-domain operations to transformed block b, leaving it ready for the inverse transform
+// returns the normalized dc coefficient before filtering
+static coeff filter_block(const struct motion_context* m, struct motion_worker* w, int i, uint64_t b, coeff* coeffs) {
+	const struct coords block = m->block[i], minbuf = m->minbuf[i], active = m->active[i], nblocks = m->nblocks[i];
+	const struct coords bp_begin = m->bandpass.begin[i], bp_end = m->bandpass.end[i];
+	const intermediate normalization = m->normalization[i];
+	const uint64_t bz = m->bz;
+	coeff dc;
+
+	if(m->fused)
+		dc = coeffs[0]*row_forward(m,0,0)*m->forward[i][0];
+	else {
+		// coeff-limit and expressions work on normalized coeffs, so that needs its own pass
+		if(!m->ispec)
+			for(uint64_t z = 0; z < active.d; z++)
+				for(int y = 0; y < active.h; y++) {
+					coeff* row = coeffs+(z*minbuf.h+y)*minbuf.w;
+					coeff rowgain = row_forward(m,y,z);
+					for(int x = 0; x < active.w; x++)
+						row[x] *= rowgain*m->forward[i][x];
+				}
+
+		dc = coeffs[0];
+
+		// only the active region feeds the inverse transform, so that's all that competes for the limit
+		if(m->coeff_limit && m->coeff_limit < active.w*active.h*active.d) {
+			coeff** topcoeffs = w->topcoeffs;
+			size_t n = 0;
+			for(uint64_t z = 0; z < active.d; z++)
+				for(int y = 0; y < active.h; y++)
+					for(int x = 0; x < active.w; x++)
+						topcoeffs[n++] = coeffs+(z*minbuf.h+y)*minbuf.w+x;
+			select_coeffs(topcoeffs,n,m->coeff_limit);
+			for(size_t j = m->coeff_limit; j < n; j++)
+				*topcoeffs[j] = 0;
+		}
+
+		if(m->exprgain[i])
+			for(uint64_t z = 0; z < active.d; z++)
+				for(int y = 0; y < active.h; y++) {
+					coeff* row = coeffs+(z*minbuf.h+y)*minbuf.w;
+					const coeff* gain = m->exprgain[i]+(z*active.h+y)*active.w,* offset = m->exproffset[i]+(z*active.h+y)*active.w;
+					for(int x = 0; x < active.w; x++)
+						row[x] = row[x]*gain[x]+offset[x];
+				}
+		else if(m->compiled_expr)
+			for(uint64_t z = 0; z < active.d; z++)
+				for(int y = 0; y < active.h; y++) {
+					coeff* row = coeffs+(z*minbuf.h+y)*minbuf.w;
+					// exprrow holds the c and x vectors followed by the result
+					double* c = w->exprrow,* xs = w->exprrow+active.w,* out = w->exprrow+active.w*2;
+					for(int x = 0; x < active.w; x++) {
+						c[x] = row[x]*normalization*normalization/255;
+						xs[x] = x;
+					}
+					double vals[] = {
+						0, 0, y, z, i, block.w, block.h, block.d, m->components,
+						b%nblocks.w, b/nblocks.h, bz, nblocks.w, nblocks.h, block_depth(m->nblocks->d),
+						0
+					};
+					motion_expr_eval(m->compiled_expr,vals,(const double*[]){c,xs},active.w,w->exprscratch,out);
+					for(int x = 0; x < active.w; x++)
+						row[x] = out[x]/(normalization*normalization)*255;
+				}
+		else if(w->expr)
+			for(uint64_t z = 0; z < active.d; z++)
+				for(int y = 0; y < active.h; y++)
+					for(int x = 0; x < active.w; x++) {
+						double vals[] = {
+							coeffs[(z*minbuf.h+y)*minbuf.w+x]*normalization*normalization/255,
+							x, y, z, i, block.w, block.h, block.d, m->components,
+							b%nblocks.w, b/nblocks.h, bz, nblocks.w, nblocks.h, block_depth(m->nblocks->d),
+							0
+						};
+						coeffs[(z*minbuf.h+y)*minbuf.w+x] = av_expr_eval(w->expr,vals,NULL)/(normalization*normalization)*255;
+					}
+	}
+
+	for(uint64_t z = 0; z < active.d; z++)
+		for(int y = 0; y < active.h; y++) {
+			coeff* row = coeffs+(z*minbuf.h+y)*minbuf.w;
+			bool band = z >= bp_begin.d && z < bp_end.d && y >= bp_begin.h && y < bp_end.h;
+			// dc is filtered on its own below
+			w->coeffs_coded += filter_row(m,i,row,!(y || z),active.w,m->gain[i][band],m->fused ? row_forward(m,y,z) : 1,row_inverse(m,y,z));
+		}
+
+	bool band = !bp_begin.d && bp_end.d && !bp_begin.h && bp_end.h;
+	coeff c = preserve_dc(m,w,i,threshold_coeff(m,i,coeffs[0]*(m->fused ? row_forward(m,0,0) : 1)*m->gain[i][band][0]),dc);
+	coeffs[0] = quant_coeff(m,i,c,&w->coeffs_coded)*row_inverse(m,0,0)*m->inverse[i][0];
+
+	return dc;
+}
+
+// filter the temporal column of coefficients at x,y of block b, the --out-of-core equivalent of filter_block
+// only the first depth coefficients of the column are present, the rest are taken to be 0
+static void filter_column(const struct motion_context* m, struct motion_worker* w, int i, uint64_t b, int x, int y, coeff* col, uint64_t depth) {
+	const struct coords block = m->block[i], nblocks = m->nblocks[i];
+	const struct coords bp_begin = m->bandpass.begin[i], bp_end = m->bandpass.end[i];
+	const intermediate normalization = m->normalization[i];
+	const bool band = x >= bp_begin.w && x < bp_end.w && y >= bp_begin.h && y < bp_end.h;
+
+	for(uint64_t z = 0; z < depth; z++)
+		col[z] *= row_forward(m,y,z)*m->forward[i][x];
+
+	coeff dc = col[0];
+
+	if(m->compiled_expr) {
+		double* c = w->exprrow,* zs = w->exprrow+depth,* out = w->exprrow+depth*2;
+		for(uint64_t z = 0; z < depth; z++) {
+			c[z] = col[z]*normalization*normalization/255;
+			zs[z] = z;
+		}
+		double vals[] = {
+			0, x, y, 0, i, block.w, block.h, block.d, m->components,
+			b%nblocks.w, b/nblocks.h, m->bz, nblocks.w, nblocks.h, block_depth(m->nblocks->d),
+			0
+		};
+		motion_expr_eval(m->compiled_expr,vals,(const double*[]){c,NULL,NULL,zs},depth,w->exprscratch,out);
+		for(uint64_t z = 0; z < depth; z++)
+			col[z] = out[z]/(normalization*normalization)*255;
+	}
+	else if(w->expr)
+		for(uint64_t z = 0; z < depth; z++) {
+			double vals[] = {
+				col[z]*normalization*normalization/255,
+				x, y, z, i, block.w, block.h, block.d, m->components,
+				b%nblocks.w, b/nblocks.h, m->bz, nblocks.w, nblocks.h, block_depth(m->nblocks->d),
+				0
+			};
+			col[z] = av_expr_eval(w->expr,vals,NULL)/(normalization*normalization)*255;
+		}
+
+	for(uint64_t z = 0; z < depth; z++) {
+		coeff c = threshold_coeff(m,i,col[z]*(band && z >= bp_begin.d && z < bp_end.d ? m->boost[i] : m->damp[i]));
+		if(!x && !y && !z)
+			c = preserve_dc(m,w,i,c,dc);
+		col[z] = quant_coeff(m,i,c,&w->coeffs_coded)*row_inverse(m,y,z)*m->inverse[i][x];
+	}
+}
+
+// convert a w x h slice of the output of the inverse transform (or spectrogram) back into pixels
+static void store_slice(const struct motion_context* m, int i, void* pslice, coeff* cslice, int w, int h, size_t stride, intermediate c) {
+	const intermediate normalization = m->normalization[i], scalefactor = m->scalefactor[i], pelmax = m->pelmax[i];
+	for(int y = 0; y < h; y++)
+		for(int x = 0; x < w; x++) {
+			intermediate pel = cslice[y*stride+x] * scalefactor * normalization;
+
+			switch(m->spec) {
+				case spectype_abs:   pel = c*mi(log1p)(mi(fabs)(pel)); break;
+				case spectype_shift: pel = c*mi(copysign)(mi(log1p)(mi(fabs)(pel)),pel)+mi(127.5); break;
+				case spectype_flat:  pel = pel*normalization/2+mi(127.5); break;
+				case spectype_copy:
+				case spectype_none:
+					pel *= normalization;
+					if(m->linear)
+						pel = m->output_trc(pel/255)*255;
+					break;
+			}
+
+			if(m->float_pixels)
+				((float*)pslice)[y*stride+x] = pel/255;
+			else if(m->deep_pixels) {
+				pel = pel*pelmax/255;
+				((uint16_t*)pslice)[y*stride+x] = pel > pelmax ? pelmax : pel < 0 ? 0 : mi(lround)(pel);
+			}
+			else
+				((unsigned char*)pslice)[y*stride+x] = pel > 255 ? 255 : pel < 0 ? 0 : mi(lround)(pel);
+
+			if(m->dithering) {
+				unsigned char p = ((unsigned char*)pslice)[y*stride+x];
+				intermediate dp = cslice[y*stride+x]-p/(normalization*normalization*scalefactor);
+				if(x < w-1) cslice[y*stride+x+1] += dp*7/16;
+				if(y < h-1) {
+					if(x) cslice[(y+1)*stride+x-1] += dp*3/16;
+					cslice[(y+1)*stride+x] += dp*5/16;
+					if(x < w-1) cslice[(y+1)*stride+x+1] += dp/16;
+				}
+			}
+		}
+}
+
+static void store_block(const struct motion_context* m, int i, void* pblock, coeff* coeffs, coeff dc) {
+	const struct coords scaled = m->pelscaled[i], minbuf = m->minbuf[i];
+	const size_t pelsize = m->pelsize;
+	intermediate c = m->c[i];
+
+	if(m->spec == spectype_abs) c = 255/mi(log1p)(mi(fabs)(dc * m->scalefactor[i] * m->normalization[i]));
+	for(uint64_t z = 0; z < scaled.d; z++)
+		store_slice(m,i,(char*)pblock+z*minbuf.h*minbuf.w*pelsize,coeffs+z*minbuf.h*minbuf.w,scaled.w,scaled.h,minbuf.w,c);
+}
+
+static int job_component(const struct motion_context* m, size_t* job, bool rows) {
+	int i;
+	for(i = 0; i < m->components; i++) {
+		if(m->bz >= m->nblocks[i].d) continue;
+		size_t n = rows ? m->nblocks[i].h : m->nblocks[i].w * m->nblocks[i].h;
+		if(*job < n) break;
+		*job -= n;
+	}
+	return i;
+}
+
+// transform the n blocks of component i laid out back to back from coeffs
+static void forward_transform(const struct motion_context* m, int i, coeff* coeffs, size_t n) {
+	const struct coords block = m->block[i], minbuf = m->minbuf[i];
+	if(m->fixed[i])
+		for(size_t b = 0; b < n; b++)
+			motion_dct_forward(coeffs+b*minbuf.w*minbuf.h*minbuf.d,block.w,block.h,block.d,minbuf.w,minbuf.w*minbuf.h);
+	else if(m->pruneforward[i][0])
+		for(int p = 0; p < 3; p++)
+			fftw(execute_r2r)(m->pruneforward[i][p],coeffs,coeffs);
+	else fftw(execute_r2r)(m->planforward[i],coeffs,coeffs);
+}
+
+// whether every frame of block pblock is within static_tolerance of its first, in 8-bit pel units
+static bool static_block(const struct motion_context* m, int i, const void* pblock) {
+	const struct coords block = m->pelblock[i], minbuf = m->minbuf[i];
+	const size_t slice = minbuf.w*minbuf.h;
+	for(uint64_t z = 1; z < block.d; z++)
+		for(int y = 0; y < block.h; y++) {
+			const size_t row = y*minbuf.w;
+			if(m->float_pixels) {
+				const float* first = (const float*)pblock+row,* pels = first+z*slice;
+				for(int x = 0; x < block.w; x++)
+					if(fabsf(pels[x]-first[x])*255 > m->static_tolerance)
+						return false;
+			}
+			else if(m->deep_pixels) {
+				const uint16_t* first = (const uint16_t*)pblock+row,* pels = first+z*slice;
+				const intermediate tolerance = m->static_tolerance*m->pelmax[i]/255;
+				for(int x = 0; x < block.w; x++)
+					if(abs(pels[x]-first[x]) > tolerance)
+						return false;
+			}
+			else {
+				const unsigned char* first = (const unsigned char*)pblock+row,* pels = first+z*slice;
+				if(!m->static_tolerance) {
+					if(memcmp(pels,first,block.w))
+						return false;
+				}
+				else for(int x = 0; x < block.w; x++)
+					if(abs(pels[x]-first[x]) > m->static_tolerance)
+						return false;
+			}
+		}
+	return true;
+}
+
+// the forward transform of a static block loaded into coeffs: a REDFT10 along z of frames that are all alike is their
+// sum at k = 0 and 0 everywhere else, so the frames are summed into the first and that is transformed on its own
+static void forward_static(const struct motion_context* m, int i, coeff* coeffs) {
+	const struct coords block = m->block[i], minbuf = m->minbuf[i];
+	const size_t slice = minbuf.w*minbuf.h;
+	for(uint64_t z = 1; z < block.d; z++)
+		for(int y = 0; y < block.h; y++) {
+			coeff* restrict sum = coeffs+y*minbuf.w;
+			const coeff* restrict row = coeffs+z*slice+y*minbuf.w;
+			for(int x = 0; x < block.w; x++)
+				sum[x] += row[x];
+		}
+	memset(coeffs+slice,0,sizeof(coeff)*slice*(minbuf.d-1));
+	// a size 1 REDFT10 doubles, standing in for the factor of 2 along z
+	if(m->fixed[i])
+		motion_dct_forward(coeffs,block.w,block.h,1,minbuf.w,slice);
+	else fftw(execute_r2r)(m->staticforward[i],coeffs,coeffs);
+}
+
+// the inverse of a static block whose temporal AC coeffs are still 0 after filtering is its first frame's repeated,
+// returns false to fall back to the full inverse when filtering made any of them nonzero
+static bool inverse_static(const struct motion_context* m, int i, coeff* coeffs) {
+	const struct coords scaled = m->scaled[i], minbuf = m->minbuf[i], active = m->active[i];
+	const size_t slice = minbuf.w*minbuf.h;
+	for(uint64_t z = 1; z < active.d; z++)
+		for(int y = 0; y < active.h; y++) {
+			const coeff* row = coeffs+z*slice+y*minbuf.w;
+			for(int x = 0; x < active.w; x++)
+				if(row[x])
+					return false;
+		}
+	if(m->fixed[i])
+		motion_dct_inverse(coeffs,scaled.w,scaled.h,1,minbuf.w,slice);
+	else fftw(execute_r2r)(m->staticinverse[i],coeffs,coeffs);
+	for(uint64_t z = 1; z < scaled.d; z++)
+		for(int y = 0; y < scaled.h; y++)
+			memcpy(coeffs+z*slice+y*minbuf.w,coeffs+y*minbuf.w,sizeof(coeff)*scaled.w);
+	return true;
+}
+
+// the number of nonzero coeffs in the active region of a filtered block, counting stops past limit
+static size_t count_nonzero(const struct motion_context* m, int i, const coeff* coeffs, size_t limit) {
+	const struct coords minbuf = m->minbuf[i], active = m->active[i];
+	size_t n = 0;
+	for(uint64_t z = 0; z < active.d; z++)
+		for(int y = 0; y < active.h; y++) {
+			const coeff* row = coeffs+(z*minbuf.h+y)*minbuf.w;
+			for(int x = 0; x < active.w; x++)
+				n += !!row[x];
+			if(n > limit)
+				return n;
+		}
+	return n;
+}
+
+// the inverse transform of a block with at most sparse[i] nonzero coeffs, as the sum of their separable basis functions
+static void synthesize_block(const struct motion_context* m, struct motion_worker* w, int i, coeff* coeffs) {
+	const struct coords minbuf = m->minbuf[i], active = m->active[i], scaled = m->scaled[i];
+	const coeff* bw = m->basis[i][2],* bh = m->basis[i][1],* bd = m->basis[i][0];
+	struct motion_nonzero* nonzero = w->nonzero;
+	size_t n = 0;
+	for(uint64_t z = 0; z < active.d; z++)
+		for(int y = 0; y < active.h; y++)
+			for(int x = 0; x < active.w; x++)
+				if(coeffs[(z*minbuf.h+y)*minbuf.w+x])
+					nonzero[n++] = (struct motion_nonzero){coeffs[(z*minbuf.h+y)*minbuf.w+x],x,y,z};
+
+	for(uint64_t z = 0; z < scaled.d; z++)
+		for(int y = 0; y < scaled.h; y++)
+			memset(coeffs+(z*minbuf.h+y)*minbuf.w,0,sizeof(coeff)*scaled.w);
+
+	for(size_t k = 0; k < n; k++) {
+		const coeff* restrict basis = bw+nonzero[k].x*scaled.w;
+		for(uint64_t z = 0; z < scaled.d; z++) {
+			coeff cz = nonzero[k].c*bd[nonzero[k].z*scaled.d+z];
+			for(int y = 0; y < scaled.h; y++) {
+				coeff cy = cz*bh[nonzero[k].y*scaled.h+y];
+				coeff* restrict row = coeffs+(z*minbuf.h+y)*minbuf.w;
+				for(int x = 0; x < scaled.w; x++)
+					row[x] += cy*basis[x];
+			}
+		}
+	}
+}
+
+static void inverse_transform(const struct motion_context* m, int i, coeff* coeffs, size_t n) {
+	const struct coords scaled = m->scaled[i], minbuf = m->minbuf[i];
+	if(m->fixed[i])
+		for(size_t b = 0; b < n; b++)
+			motion_dct_inverse(coeffs+b*minbuf.w*minbuf.h*minbuf.d,scaled.w,scaled.h,scaled.d,minbuf.w,minbuf.w*minbuf.h);
+	else if(m->pruneinverse[i][0])
+		for(int p = 0; p < 3; p++)
+			fftw(execute_r2r)(m->pruneinverse[i][p],coeffs,coeffs);
+	else fftw(execute_r2r)(m->planinverse[i],coeffs,coeffs);
+}
+
+static inline coeff* cached_block(const struct motion_context* m, int i, uint64_t b) {
+	const struct coords active = m->active[i];
+	return m->cache.map + m->bz*m->cache.stride + m->cache.offset[i] + b*active.w*active.h*active.d;
+}
+
+// copy the active region of a forward transformed block between coeffs and packed, the rest of coeffs is left 0 when unpacking
+static void pack_block(const struct motion_context* m, int i, coeff* coeffs, coeff* packed, bool unpack) {
+	const struct coords minbuf = m->minbuf[i], active = m->active[i];
+	if(unpack)
+		memset(coeffs,0,sizeof(coeff)*m->mincomponent);
+	for(uint64_t z = 0; z < active.d; z++)
+		for(int y = 0; y < active.h; y++) {
+			coeff* row = coeffs+(z*minbuf.h+y)*minbuf.w,* prow = packed+(z*active.h+y)*active.w;
+			if(unpack)
+				memcpy(row,prow,sizeof(coeff)*active.w);
+			else
+				memcpy(prow,row,sizeof(coeff)*active.w);
+		}
+}
+
+// filter and invert a forward transformed block into pblock
+static void finish_block(const struct motion_context* m, struct motion_worker* w, int i, uint64_t b, coeff* coeffs, void* pblock, bool still) {
+	coeff dc = filter_block(m,w,i,b,coeffs);
+	if(m->sparse[i] && count_nonzero(m,i,coeffs,m->sparse[i]) <= m->sparse[i])
+		synthesize_block(m,w,i,coeffs);
+	else if(!m->spec && !(still && inverse_static(m,i,coeffs)))
+		inverse_transform(m,i,coeffs,1);
+	store_block(m,i,pblock,coeffs,dc);
+}
+
+// transform, filter, and invert a single block of pixels[i][b] in place
+static void transform_block(void* arg, size_t job, int worker) {
+	struct motion_context* m = arg;
+	struct motion_worker* w = m->workers + worker;
+	int i = job_component(m,&job,false);
+	uint64_t b = job;
+	coeff* coeffs = w->coeffs;
+	void* pblock = m->pixels[i][b];
+	bool still = false;
+
+	if(m->cache.hit)
+		pack_block(m,i,coeffs,cached_block(m,i,b),true);
+	else {
+		still = m->static_tolerance >= 0 && m->block[i].d > 1 && static_block(m,i,pblock);
+		w->static_blocks += still;
+		load_block(m,i,pblock,coeffs,m->mincomponent);
+		if(still)
+			forward_static(m,i,coeffs);
+		else if(!m->ispec)
+			forward_transform(m,i,coeffs,1);
+		if(m->cache.map)
+			pack_block(m,i,coeffs,cached_block(m,i,b),false);
+	}
+	if(m->nextra)
+		pack_block(m,i,coeffs,w->packed,false);
+	finish_block(m,w,i,b,coeffs,pblock,still);
+	for(int o = 0; o < m->nextra; o++) {
+		const struct motion_context* x = m->extra+o;
+		pack_block(m,i,coeffs,w->packed,true);
+		finish_block(x,x->workers+worker,i,b,coeffs,x->pixels[i][b],still);
+	}
+}
+
+// with --batch the blocks of a row are laid out back to back and transformed by a single plan
+static void transform_row(void* arg, size_t job, int worker) {
+	struct motion_context* m = arg;
+	struct motion_worker* w = m->workers + worker;
+	int i = job_component(m,&job,true);
+	const uint64_t row = job * m->nblocks[i].w, nbx = m->nblocks[i].w;
+	const size_t len = m->minbuf[i].w*m->minbuf[i].h*m->minbuf[i].d;
+
+	for(uint64_t bx = 0; bx < nbx; bx++)
+		load_block(m,i,m->pixels[i][row+bx],w->coeffs+bx*len,len);
+	if(!m->ispec)
+		forward_transform(m,i,w->coeffs,nbx);
+	for(uint64_t bx = 0; bx < nbx; bx++)
+		w->dc[bx] = filter_block(m,w,i,row+bx,w->coeffs+bx*len);
+	// the row shares one plan, so it's only synthesized when every block in it is sparse
+	bool sparse = m->sparse[i];
+	for(uint64_t bx = 0; bx < nbx && sparse; bx++)
+		sparse = count_nonzero(m,i,w->coeffs+bx*len,m->sparse[i]) <= m->sparse[i];
+	if(sparse)
+		for(uint64_t bx = 0; bx < nbx; bx++)
+			synthesize_block(m,w,i,w->coeffs+bx*len);
+	else if(!m->spec)
+		inverse_transform(m,i,w->coeffs,nbx);
+	for(uint64_t bx = 0; bx < nbx; bx++)
+		store_block(m,i,m->pixels[i][row+bx],w->coeffs+bx*len,w->dc[bx]);
+}
+
+// the blocks of each component are laid out back to back in a single slab starting at pixels[i][0]
+static void*** alloc_pixels(const struct motion_context* m) {
+	const size_t pelsize = m->pelsize;
+	void*** pixels = calloc(m->components,sizeof(*pixels));
+	for(int i = 0; i < m->components; i++) {
+		const size_t nb = m->nblocks[i].w*m->nblocks[i].h, len = m->minbuf[i].w*m->minbuf[i].h*m->minbuf[i].d*pelsize;
+		pixels[i] = malloc(sizeof(*pixels[i])*MAX(nb,1));
+		pixels[i][0] = malloc(nb*len);
+		for(size_t b = 1; b < nb; b++)
+			pixels[i][b] = (char*)pixels[i][0]+b*len;
+	}
+	return pixels;
+}
+
+static void free_pixels(const struct motion_context* m, void*** pixels) {
+	if(!pixels)
+		return;
+	for(int i = 0; i < m->components; i++) {
+		free(pixels[i][0]);
+		free(pixels[i]);
+	}
+	free(pixels);
+}
+
+static void print_progress(struct motion_context* m, uint64_t read, uint64_t wrote) {
+	pthread_mutex_lock(&m->progress.lock);
+	if(read != UINT64_MAX) m->progress.read = read;
+	if(wrote != UINT64_MAX) m->progress.wrote = wrote;
+	fprintf(stderr,"\rread: %*" PRIu64 " wrote: %*" PRIu64,m->progress.padb,m->progress.read,m->progress.pads,m->progress.wrote);
+	pthread_mutex_unlock(&m->progress.lock);
+}
+
+// count frames read and written out of order, with --segments
+static void add_progress(struct motion_context* m, uint64_t read, uint64_t wrote) {
+	pthread_mutex_lock(&m->progress.lock);
+	m->progress.read += read;
+	m->progress.wrote += wrote;
+	fprintf(stderr,"\rread: %*" PRIu64 " wrote: %*" PRIu64,m->progress.padb,m->progress.read,m->progress.pads,m->progress.wrote);
+	pthread_mutex_unlock(&m->progress.lock);
+}
+
+// repeat frame z-1 of temporal block bz through the rest of the block
+static void pad_block(struct motion_context* m, void*** pixels, uint64_t bz, uint64_t z) {
+	const size_t pelsize = m->pelsize;
+	for(int i = 0; i < m->components; i++) {
+		const struct coords block = m->pelblock[i], minbuf = m->minbuf[i], nblocks = m->nblocks[i];
+		if(bz >= nblocks.d || z >= block.d) continue;
+		const size_t slice = minbuf.w*minbuf.h*pelsize;
+		for(size_t b = 0; b < nblocks.w*nblocks.h; b++)
+			for(uint64_t zz = z; zz < block.d; zz++)
+				memcpy((char*)pixels[i][b]+zz*slice,(char*)pixels[i][b]+(z-1)*slice,slice);
+	}
+	m->tail = z;
+}
+
+// decode the frames of temporal block bz into pixels
+static int read_block(struct motion_context* m, FFContext* in, AVFrame* readframe, void*** pixels, uint64_t bz) {
+	int err;
+	// only --stream reads tail, and the pipeline's encoder thread must not see it written
+	if(m->stream)
+		m->tail = 0;
+	// the coefficients come from the cache instead
+	if(m->cache.hit) {
+		if(!m->progress.quiet)
+			print_progress(m,(bz+1)*m->pelblock->d,UINT64_MAX);
+		return 0;
+	}
+	for(uint64_t z = 0; z < m->pelblock->d; z++) {
+		if((err = ffapi_read_frame(in,readframe))) {
+			if(err != AVERROR_EOF || m->stream != streamtype_pad || !z)
+				return err;
+			pad_block(m,pixels,bz,z);
+			return 0;
+		}
+		for(int i = 0; i < m->components; i++) {
+			const struct coords block = m->pelblock[i], minbuf = m->minbuf[i], nblocks = m->nblocks[i];
+			if(bz >= nblocks.d || z >= block.d) continue;
+			AVComponentDescriptor comp = m->pixdesc->comp[i];
+			for(int by = 0; by < nblocks.h; by++)
+				for(int bx = 0; bx < nblocks.w; bx++)
+					for(int y = 0; y < block.h; y++)
+						if(m->float_pixels)
+							ffapi_getrowf(in,readframe,bx*block.w,by*block.h+y,i,(float*)pixels[i][by*nblocks.w+bx]+(z*minbuf.h+y)*minbuf.w,block.w);
+						else if(m->deep_pixels)
+							ffapi_getrow16(in,readframe,bx*block.w,by*block.h+y,i,(uint16_t*)pixels[i][by*nblocks.w+bx]+(z*minbuf.h+y)*minbuf.w,block.w);
+						else
+							ffapi_getrow_direct(readframe,bx*block.w,by*block.h+y,comp,(unsigned char*)pixels[i][by*nblocks.w+bx]+(z*minbuf.h+y)*minbuf.w,block.w);
+		}
+		if(!m->progress.quiet)
+			print_progress(m,bz*m->pelblock->d+z+1,UINT64_MAX);
+	}
+	return 0;
+}
+
+// encode the transformed frames of temporal block bz from pixels
+static int write_block(struct motion_context* m, FFContext* out, AVFrame* writeframe, void*** pixels, uint64_t bz) {
+	int err;
+	const uint64_t depth = m->tail ? (m->tail*m->pelscaled->d+m->pelblock->d-1)/m->pelblock->d : m->pelscaled->d;
+	for(uint64_t z = 0; z < depth; z++) {
+		for(int i = 0; i < m->components; i++) {
+			const struct coords scaled = m->pelscaled[i], minbuf = m->minbuf[i], nblocks = m->nblocks[i];
+			if(bz >= nblocks.d || z >= scaled.d) continue;
+			AVComponentDescriptor comp = m->pixdesc->comp[i];
+			for(int by = 0; by < nblocks.h; by++)
+				for(int bx = 0; bx < nblocks.w; bx++)
+					for(int y = 0; y < scaled.h; y++)
+						if(m->float_pixels)
+							ffapi_setrowf(out,writeframe,bx*scaled.w,by*scaled.h+y,i,(float*)pixels[i][by*nblocks.w+bx]+(z*minbuf.h+y)*minbuf.w,scaled.w);
+						else if(m->deep_pixels)
+							ffapi_setrow16(out,writeframe,bx*scaled.w,by*scaled.h+y,i,(uint16_t*)pixels[i][by*nblocks.w+bx]+(z*minbuf.h+y)*minbuf.w,scaled.w);
+						else
+							ffapi_setrow_direct(writeframe,bx*scaled.w,by*scaled.h+y,comp,(unsigned char*)pixels[i][by*nblocks.w+bx]+(z*minbuf.h+y)*minbuf.w,scaled.w);
+		}
+		if((err = ffapi_write_frame(out,writeframe)))
+			return err;
+		if(!m->progress.quiet)
+			print_progress(m,UINT64_MAX,bz*m->pelscaled->d+z+1);
+	}
+	return 0;
+}
+
+// with --dct int the 8-bit pels of block pixels[i][b] are transformed as integers, quantized, and inverted in place
+// the integer transform is orthonormal, so the coeffs are quantized by --quant directly
+static void transform_block_int(void* arg, size_t job, int worker) {
+	struct motion_context* m = arg;
+	struct motion_worker* w = m->workers + worker;
+	int i = job_component(m,&job,false);
+	const struct coords block = m->block[i];
+	const size_t len = block.w*block.h*block.d;
+	unsigned char* pels = m->pixels[i][job];
+	int32_t* ints = w->ints;
+
+	for(size_t j = 0; j < len; j++)
+		ints[j] = pels[j];
+	motion_intdct_forward(ints,block.w,block.h,block.d,block.w,block.w*block.h);
+	for(size_t j = 0; j < len; j++) {
+		intermediate q = mi(round)(ints[j]/m->quant);
+		w->coeffs_coded += !!q;
+		ints[j] = mi(lround)(q*m->quant);
+	}
+	motion_intdct_inverse(ints,block.w,block.h,block.d,block.w,block.w*block.h);
+	for(size_t j = 0; j < len; j++)
+		pels[j] = ints[j] > 255 ? 255 : ints[j] < 0 ? 0 : ints[j];
+}
+
+static void transform_blocks(struct motion_context* m, void*** pixels, uint64_t bz) {
+	m->bz = bz;
+	m->pixels = pixels;
+	for(int o = 0; o < m->nextra; o++) {
+		m->extra[o].bz = bz;
+		m->extra[o].tail = m->tail;
+	}
+	// without quantization the integer transform would give back exactly the pels already there
+	if(m->intdct && !m->quant)
+		return;
+	motion_pool_run(m->pool,block_jobs(m,m->batch),m->intdct ? transform_block_int : m->batch ? transform_row : transform_block,m);
+}
+
+// copy block bx,by of the current frame into the worker's pels
+static void get_block_pels(const struct motion_context* m, struct motion_worker* w, int i, uint64_t bx, uint64_t by) {
+	const struct coords block = m->block[i];
+	const AVComponentDescriptor comp = m->pixdesc->comp[i];
+	for(int y = 0; y < block.h; y++)
+		if(m->float_pixels)
+			ffapi_getrowf(m->framectx,m->frame,bx*block.w,by*block.h+y,i,(float*)w->pels+y*block.w,block.w);
+		else if(m->deep_pixels)
+			ffapi_getrow16(m->framectx,m->frame,bx*block.w,by*block.h+y,i,(uint16_t*)w->pels+y*block.w,block.w);
+		else
+			ffapi_getrow_direct(m->frame,bx*block.w,by*block.h+y,comp,(unsigned char*)w->pels+y*block.w,block.w);
+}
+
+static void set_block_pels(const struct motion_context* m, struct motion_worker* w, int i, uint64_t bx, uint64_t by) {
+	const struct coords block = m->block[i];
+	const AVComponentDescriptor comp = m->pixdesc->comp[i];
+	for(int y = 0; y < block.h; y++)
+		if(m->float_pixels)
+			ffapi_setrowf(m->framectx,m->frame,bx*block.w,by*block.h+y,i,(float*)w->pels+y*block.w,block.w);
+		else if(m->deep_pixels)
+			ffapi_setrow16(m->framectx,m->frame,bx*block.w,by*block.h+y,i,(uint16_t*)w->pels+y*block.w,block.w);
+		else
+			ffapi_setrow_direct(m->frame,bx*block.w,by*block.h+y,comp,(unsigned char*)w->pels+y*block.w,block.w);
+}
+
+// copy block bx,by between a plane laid out like the frame and contiguous coeffs
+static void get_block_coeffs(const struct motion_context* m, int i, const coeff* plane, uint64_t bx, uint64_t by, coeff* coeffs) {
+	const struct coords block = m->block[i];
+	const uint64_t stride = m->nblocks[i].w*block.w;
+	for(int y = 0; y < block.h; y++)
+		memcpy(coeffs+y*block.w,plane+(by*block.h+y)*stride+bx*block.w,sizeof(coeff)*block.w);
+}
+
+static void put_block_coeffs(const struct motion_context* m, int i, coeff* plane, uint64_t bx, uint64_t by, const coeff* coeffs) {
+	const struct coords block = m->block[i];
+	const uint64_t stride = m->nblocks[i].w*block.w;
+	for(int y = 0; y < block.h; y++)
+		memcpy(plane+(by*block.h+y)*stride+bx*block.w,coeffs+y*block.w,sizeof(coeff)*block.w);
+}
+
+static inline coeff* ooc_plane(const struct motion_context* m, int i, uint64_t z) {
+	return m->ooc.map + m->ooc.offset[i] + z*m->ooc.plane[i];
+}
+
+// 2D transform a row of blocks from frame z into the scratch file
+static void ooc_forward_frame(void* arg, size_t job, int worker) {
+	struct motion_context* m = arg;
+	struct motion_worker* w = m->workers + worker;
+	int i = job_component(m,&job,true);
+	const struct coords block = m->block[i];
+
+	for(uint64_t bx = 0; bx < m->nblocks[i].w; bx++) {
+		get_block_pels(m,w,i,bx,job);
+		load_slice(m,i,w->pels,w->coeffs,block.w,block.h,block.w);
+		fftw(execute_r2r)(m->planforward[i],w->coeffs,w->coeffs);
+		put_block_coeffs(m,i,ooc_plane(m,i,m->z),bx,job,w->coeffs);
+	}
+}
+
+// invert the 2D transform of a row of blocks of frame z from the scratch file
+static void ooc_inverse_frame(void* arg, size_t job, int worker) {
+	struct motion_context* m = arg;
+	struct motion_worker* w = m->workers + worker;
+	int i = job_component(m,&job,true);
+	const struct coords block = m->block[i];
+
+	for(uint64_t bx = 0; bx < m->nblocks[i].w; bx++) {
+		get_block_coeffs(m,i,ooc_plane(m,i,m->z),bx,job,w->coeffs);
+		fftw(execute_r2r)(m->planinverse[i],w->coeffs,w->coeffs);
+		store_slice(m,i,w->pels,w->coeffs,block.w,block.h,block.w,m->c[i]);
+		set_block_pels(m,w,i,bx,job);
+	}
+}
+
+// frames are gathered this many at a time when transposing so that reads from each plane stay within a few cache lines
+#define OOC_TRANSPOSE_TILE 16
+
+static size_t ooc_tiles(const struct motion_context* m) {
+	size_t tiles = 0;
+	for(int i = 0; i < m->components; i++)
+		if(m->bz < m->nblocks[i].d)
+			tiles += (m->ooc.plane[i]+m->ooc.tile-1)/m->ooc.tile;
+	return tiles;
+}
+
+// transpose a tile of columns out of the scratch file, transform, filter, and invert them along z, and put them back
+static void ooc_temporal(void* arg, size_t job, int worker) {
+	struct motion_context* m = arg;
+	struct motion_worker* w = m->workers + worker;
+	const size_t tile = m->ooc.tile;
+	int i;
+	for(i = 0; i < m->components; i++) {
+		if(m->bz >= m->nblocks[i].d) continue;
+		size_t n = (m->ooc.plane[i]+tile-1)/tile;
+		if(job < n) break;
+		job -= n;
+	}
+	const struct coords block = m->block[i], nblocks = m->nblocks[i];
+	const uint64_t depth = block.d, stride = nblocks.w*block.w;
+	const size_t plane = m->ooc.plane[i], p0 = job*tile, len = MIN(tile,plane-p0);
+	coeff* planes = ooc_plane(m,i,0);
+	coeff* cols = w->coeffs;
+
+	for(uint64_t z0 = 0; z0 < depth; z0 += OOC_TRANSPOSE_TILE)
+		for(size_t t = 0; t < len; t++)
+			for(uint64_t z = z0; z < MIN(z0+OOC_TRANSPOSE_TILE,depth); z++)
+				cols[t*depth+z] = planes[z*plane+p0+t];
+
+	// the plans always cover a whole tile, past len they work on leftovers from the previous tile
+	fftw(execute_r2r)(m->ooc.temporal[0],cols,cols);
+	for(size_t t = 0; t < len; t++) {
+		uint64_t px = (p0+t) % stride, py = (p0+t) / stride;
+		filter_column(m,w,i,py/block.h*nblocks.w+px/block.w,px%block.w,py%block.h,cols+t*depth,depth);
+	}
+	fftw(execute_r2r)(m->ooc.temporal[1],cols,cols);
+
+	for(uint64_t z0 = 0; z0 < depth; z0 += OOC_TRANSPOSE_TILE)
+		for(size_t t = 0; t < len; t++)
+			for(uint64_t z = z0; z < MIN(z0+OOC_TRANSPOSE_TILE,depth); z++)
+				planes[z*plane+p0+t] = cols[t*depth+z];
+}
+
+static inline coeff* band_plane(const struct motion_context* m, int i, uint64_t k) {
+	return m->incremental.bands + m->incremental.offset[i] + k*m->incremental.plane[i];
+}
+
+// add a row of blocks of frame z into each temporal band, the spatial transform waits until the temporal block is complete
+static void incremental_accumulate(void* arg, size_t job, int worker) {
+	struct motion_context* m = arg;
+	struct motion_worker* w = m->workers + worker;
+	int i = job_component(m,&job,true);
+	const struct coords block = m->block[i];
+	const uint64_t stride = m->nblocks[i].w*block.w, nbands = m->incremental.nbands;
+	const coeff* weights = m->incremental.forward + m->z*nbands;
+
+	for(uint64_t bx = 0; bx < m->nblocks[i].w; bx++) {
+		get_block_pels(m,w,i,bx,job);
+		load_slice(m,i,w->pels,w->coeffs,block.w,block.h,block.w);
+		for(uint64_t k = 0; k < nbands; k++)
+			for(int y = 0; y < block.h; y++) {
+				coeff* restrict row = band_plane(m,i,k)+(job*block.h+y)*stride+bx*block.w;
+				const coeff* restrict pel = w->coeffs+y*block.w;
+				for(int x = 0; x < block.w; x++)
+					row[x] += weights[k]*pel[x];
+			}
+	}
+}
+
+// spatially transform, filter, and invert the accumulated bands of a row of blocks
+static void incremental_filter(void* arg, size_t job, int worker) {
+	struct motion_context* m = arg;
+	struct motion_worker* w = m->workers + worker;
+	int i = job_component(m,&job,true);
+	const struct coords block = m->block[i];
+	const uint64_t stride = m->nblocks[i].w*block.w, nbands = m->incremental.nbands;
+
+	for(uint64_t bx = 0; bx < m->nblocks[i].w; bx++) {
+		for(uint64_t k = 0; k < nbands; k++) {
+			get_block_coeffs(m,i,band_plane(m,i,k),bx,job,w->coeffs);
+			fftw(execute_r2r)(m->planforward[i],w->coeffs,w->coeffs);
+			put_block_coeffs(m,i,band_plane(m,i,k),bx,job,w->coeffs);
+		}
+		for(int y = 0; y < block.h; y++)
+			for(int x = 0; x < block.w; x++) {
+				const size_t pos = (job*block.h+y)*stride+bx*block.w+x;
+				for(uint64_t k = 0; k < nbands; k++)
+					w->coeffs[k] = band_plane(m,i,k)[pos];
+				filter_column(m,w,i,job*m->nblocks[i].w+bx,x,y,w->coeffs,nbands);
+				for(uint64_t k = 0; k < nbands; k++)
+					band_plane(m,i,k)[pos] = w->coeffs[k];
+			}
+		for(uint64_t k = 0; k < nbands; k++) {
+			get_block_coeffs(m,i,band_plane(m,i,k),bx,job,w->coeffs);
+			fftw(execute_r2r)(m->planinverse[i],w->coeffs,w->coeffs);
+			put_block_coeffs(m,i,band_plane(m,i,k),bx,job,w->coeffs);
+		}
+	}
+}
+
+// sum the bands of a row of blocks back into output frame z
+static void incremental_synthesize(void* arg, size_t job, int worker) {
+	struct motion_context* m = arg;
+	struct motion_worker* w = m->workers + worker;
+	int i = job_component(m,&job,true);
+	const struct coords block = m->block[i];
+	const uint64_t stride = m->nblocks[i].w*block.w, nbands = m->incremental.nbands;
+	const coeff* weights = m->incremental.inverse + m->z*nbands;
+
+	for(uint64_t bx = 0; bx < m->nblocks[i].w; bx++) {
+		memset(w->coeffs,0,sizeof(coeff)*block.w*block.h);
+		for(uint64_t k = 0; k < nbands; k++)
+			for(int y = 0; y < block.h; y++) {
+				const coeff* restrict row = band_plane(m,i,k)+(job*block.h+y)*stride+bx*block.w;
+				coeff* restrict pel = w->coeffs+y*block.w;
+				for(int x = 0; x < block.w; x++)
+					pel[x] += weights[k]*row[x];
+			}
+		store_slice(m,i,w->pels,w->coeffs,block.w,block.h,block.w,m->c[i]);
+		set_block_pels(m,w,i,bx,job);
+	}
+}
+
+// decode the frames of temporal block bz running forward on each, run filter once, then run inverse on and encode each
+static int transform_frames(struct motion_context* m, FFContext* in, FFContext* out, AVFrame* readframe, AVFrame* writeframe, uint64_t bz,
+                            motion_pool_job* forward, motion_pool_job* filter, size_t (*filter_jobs)(const struct motion_context*), motion_pool_job* inverse) {
+	int err;
+	m->bz = bz;
+	const size_t rows = block_jobs(m,true);
+
+	m->framectx = in;
+	m->frame = readframe;
+	for(uint64_t z = 0; z < m->block->d; z++) {
+		if((err = ffapi_read_frame(in,readframe)))
+			return err;
+		m->z = z;
+		motion_pool_run(m->pool,rows,forward,m);
+		if(!m->progress.quiet)
+			print_progress(m,bz*m->block->d+z+1,UINT64_MAX);
+	}
+
+	motion_pool_run(m->pool,filter_jobs ? filter_jobs(m) : rows,filter,m);
+
+	m->framectx = out;
+	m->frame = writeframe;
+	for(uint64_t z = 0; z < m->block->d; z++) {
+		m->z = z;
+		motion_pool_run(m->pool,rows,inverse,m);
+		if((err = ffapi_write_frame(out,writeframe)))
+			return err;
+		if(!m->progress.quiet)
+			print_progress(m,UINT64_MAX,bz*m->block->d+z+1);
+	}
+	return 0;
+}
+
+// With --pipeline decoding, transforming and encoding each run on their own thread, handing temporal blocks along
+// through a ring of pixel slabs. Each stage counts the blocks it has finished and waits on the stage before it.
+#define PIPELINE_SLABS 3
+
+struct motion_pipeline {
+	struct motion_context* m;
+	FFContext* in,* out;
+	void*** slabs[PIPELINE_SLABS];
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint64_t decoded, transformed, encoded;
+	int err;
+	bool failed;
+};
+
+// wait until the previous stage has finished `needed` blocks
+static bool pipeline_wait(struct motion_pipeline* p, const uint64_t* prev, uint64_t needed) {
+	pthread_mutex_lock(&p->lock);
+	while(!p->failed && *prev < needed)
+		pthread_cond_wait(&p->cond,&p->lock);
+	bool failed = p->failed;
+	pthread_mutex_unlock(&p->lock);
+	return !failed;
+}
+
+static void pipeline_advance(struct motion_pipeline* p, uint64_t* stage, int err) {
+	pthread_mutex_lock(&p->lock);
+	if(err) {
+		p->err = err;
+		p->failed = true;
+	}
+	else (*stage)++;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+}
+
+static void* pipeline_decode(void* arg) {
+	struct motion_pipeline* p = arg;
+	AVFrame* frame = ffapi_alloc_frame(p->in);
+	for(uint64_t bz = 0; bz < p->m->nblocks->d; bz++) {
+		if(!pipeline_wait(p,&p->encoded,bz < PIPELINE_SLABS ? 0 : bz-PIPELINE_SLABS+1))
+			break;
+		int err = read_block(p->m,p->in,frame,p->slabs[bz%PIPELINE_SLABS],bz);
+		if(err)
+			fprintf(stderr,"\nError reading frame: %s\n",av_err2str(err));
+		pipeline_advance(p,&p->decoded,err);
+		if(err)
+			break;
+	}
+	ffapi_free_frame(frame);
+	return NULL;
+}
+
+static void* pipeline_encode(void* arg) {
+	struct motion_pipeline* p = arg;
+	AVFrame* frame = ffapi_alloc_frame(p->out);
+	for(uint64_t bz = 0; bz < p->m->nblocks->d; bz++) {
+		if(!pipeline_wait(p,&p->transformed,bz+1))
+			break;
+		int err = write_block(p->m,p->out,frame,p->slabs[bz%PIPELINE_SLABS],bz);
+		if(err)
+			fprintf(stderr,"\nError writing frame: %s\n",av_err2str(err));
+		pipeline_advance(p,&p->encoded,err);
+		if(err)
+			break;
+	}
+	ffapi_free_frame(frame);
+	return NULL;
+}
+
+static int run_pipeline(struct motion_pipeline* p) {
+	pthread_t decoder, encoder;
+	pthread_mutex_init(&p->lock,NULL);
+	pthread_cond_init(&p->cond,NULL);
+	int err = 0;
+	if(pthread_create(&decoder,NULL,pipeline_decode,p)) {
+		fprintf(stderr,"\nError creating pipeline threads\n");
+		err = AVERROR(EAGAIN);
+		goto end;
+	}
+	if(pthread_create(&encoder,NULL,pipeline_encode,p)) {
+		fprintf(stderr,"\nError creating pipeline threads\n");
+		pipeline_advance(p,NULL,AVERROR(EAGAIN));
+		pthread_join(decoder,NULL);
+		err = AVERROR(EAGAIN);
+		goto end;
+	}
+	for(uint64_t bz = 0; bz < p->m->nblocks->d; bz++) {
+		if(!pipeline_wait(p,&p->decoded,bz+1))
+			break;
+		transform_blocks(p->m,p->slabs[bz%PIPELINE_SLABS],bz);
+		pipeline_advance(p,&p->transformed,0);
+	}
+	pthread_join(decoder,NULL);
+	pthread_join(encoder,NULL);
+	err = p->err;
+
+end:
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->lock);
+	return err;
+}
+
+// With --segments the temporal blocks are split into contiguous runs, each decoded from its own input seeked to the start
+// of the run, transformed by its own workers, and encoded into its own temporary file. Blocks are independent, so the
+// runs only meet again when the files are appended to the output in order.
+struct motion_segment {
+	struct motion_context m;
+	struct motion_context* parent;
+	int threads;
+	uint64_t begin, end;
+	FFContext* in,* out;
+	char* path;
+	pthread_t thread;
+	bool started;
+	int err;
+};
+
+static void* run_segment(void* arg) {
+	struct motion_segment* s = arg;
+	AVFrame* readframe = ffapi_alloc_frame(s->in);
+	AVFrame* writeframe = ffapi_alloc_frame(s->out);
+	for(uint64_t bz = s->begin; bz < s->end; bz++) {
+		if((s->err = read_block(&s->m,s->in,readframe,s->m.pixels,bz))) {
+			fprintf(stderr,"\nError reading frame: %s\n",av_err2str(s->err));
+			break;
+		}
+		transform_blocks(&s->m,s->m.pixels,bz);
+		if((s->err = write_block(&s->m,s->out,writeframe,s->m.pixels,bz))) {
+			fprintf(stderr,"\nError writing frame: %s\n",av_err2str(s->err));
+			break;
+		}
+		if(!s->parent->progress.quiet)
+			add_progress(s->parent,s->m.pelblock->d,s->m.pelscaled->d);
+	}
+	ffapi_free_frame(readframe);
+	ffapi_free_frame(writeframe);
+	return NULL;
+}
+
+// With --checkpoint every interval temporal blocks are encoded into their own file in the checkpoint directory, which
+// is renamed into place once complete, so a run that's cut short can be resumed after the last complete one. The files
+// are appended to the output at the end. The directory's manifest holds the parsed settings that determine the output.
+static char* checkpoint_path(const char* dir, uint64_t n, bool part) {
+	char* path = malloc(strlen(dir)+sizeof("/segment-18446744073709551615.nut.part"));
+	sprintf(path,"%s/segment-%06" PRIu64 ".nut%s",dir,n,part ? ".part" : "");
+	return path;
+}
+
+// start a checkpoint in dir, clearing out any previous one, or check the one there was started with the same manifest
+// and count its complete segments, returns an errno or -1 when the manifest doesn't match
+static int open_checkpoint(const char* dir, const char* manifest, bool resume, uint64_t* done) {
+	*done = 0;
+	if(mkdir(dir,0777) && errno != EEXIST)
+		return errno;
+	char* path = malloc(strlen(dir)+sizeof("/manifest"));
+	sprintf(path,"%s/manifest",dir);
+	const size_t len = strlen(manifest);
+	int err = 0;
+	FILE* f = fopen(path,resume ? "rb" : "wb");
+	if(!f)
+		err = errno;
+	else if(resume) {
+		char* buf = malloc(len+1);
+		if(fread(buf,1,len+1,f) != len || memcmp(buf,manifest,len))
+			err = -1;
+		free(buf);
+	}
+	else if(fwrite(manifest,1,len,f) != len)
+		err = errno;
+	if(f && fclose(f) && !err)
+		err = errno;
+	free(path);
+
+	for(uint64_t n = 0; !err; n++) {
+		char* segment = checkpoint_path(dir,n,false);
+		bool exists = !access(segment,F_OK);
+		if(exists && !resume)
+			unlink(segment);
+		free(segment);
+		if(!exists)
+			break;
+		if(resume)
+			*done = n+1;
+	}
+	return err;
+}
+
+// remove a checkpoint whose segments have all been appended to the output
+static void close_checkpoint(const char* dir, uint64_t nsegments) {
+	for(uint64_t n = 0; n < nsegments; n++) {
+		char* segment = checkpoint_path(dir,n,false);
+		unlink(segment);
+		free(segment);
+	}
+	char* path = malloc(strlen(dir)+sizeof("/manifest"));
+	sprintf(path,"%s/manifest",dir);
+	unlink(path);
+	free(path);
+	rmdir(dir);
+}
+
+#define CACHE_MAGIC "motionC\1"
+
+// map the cache file for key under dir, reading it when a complete one exists and otherwise creating a temporary one
+// to be renamed into place by close_coeff_cache once it's been filled, returns 0 or an errno
+static int open_coeff_cache(struct motion_context* m, const char* dir, const char* key) {
+	const size_t keylen = strlen(key), pagesize = sysconf(_SC_PAGESIZE);
+	const size_t header = (sizeof(CACHE_MAGIC)+sizeof(uint64_t)+keylen+pagesize-1)/pagesize*pagesize;
+	m->cache.maplen = header+m->cache.len*sizeof(coeff);
+
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ull;
+	for(size_t j = 0; j < keylen; j++)
+		hash = (hash ^ (unsigned char)key[j])*1099511628211ull;
+	m->cache.path = malloc(strlen(dir)+sizeof("/motion-0123456789abcdef.coeffs"));
+	sprintf(m->cache.path,"%s/motion-%016" PRIx64 ".coeffs",dir,hash);
+
+	int fd = open(m->cache.path,O_RDONLY);
+	struct stat st;
+	if(fd >= 0 && !fstat(fd,&st) && (size_t)st.st_size == m->cache.maplen) {
+		char* base = mmap(NULL,m->cache.maplen,PROT_READ,MAP_SHARED,fd,0);
+		if(base != MAP_FAILED) {
+			uint64_t len;
+			memcpy(&len,base+sizeof(CACHE_MAGIC),sizeof(len));
+			if(!memcmp(base,CACHE_MAGIC,sizeof(CACHE_MAGIC)) && len == keylen && !memcmp(base+sizeof(CACHE_MAGIC)+sizeof(len),key,keylen)) {
+				close(fd);
+				m->cache.map = (coeff*)(base+header);
+				m->cache.hit = true;
+				return 0;
+			}
+			munmap(base,m->cache.maplen);
+		}
+	}
+	if(fd >= 0)
+		close(fd);
+
+	m->cache.tmppath = malloc(strlen(m->cache.path)+sizeof(".XXXXXX"));
+	sprintf(m->cache.tmppath,"%s.XXXXXX",m->cache.path);
+	char* base = MAP_FAILED;
+	if((fd = mkstemp(m->cache.tmppath)) < 0 || ftruncate(fd,m->cache.maplen) ||
+	   (base = mmap(NULL,m->cache.maplen,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0)) == MAP_FAILED) {
+		int err = errno;
+		if(fd >= 0) {
+			close(fd);
+			unlink(m->cache.tmppath);
+		}
+		free(m->cache.tmppath);
+		m->cache.tmppath = NULL;
+		return err;
+	}
+	close(fd);
+	uint64_t len = keylen;
+	memcpy(base,CACHE_MAGIC,sizeof(CACHE_MAGIC));
+	memcpy(base+sizeof(CACHE_MAGIC),&len,sizeof(len));
+	memcpy(base+sizeof(CACHE_MAGIC)+sizeof(len),key,keylen);
+	m->cache.map = (coeff*)(base+header);
+	return 0;
+}
+
+// a newly written cache only replaces the old one if the run got through every block
+static void close_coeff_cache(struct motion_context* m, bool complete) {
+	if(m->cache.map)
+		munmap((char*)m->cache.map-(m->cache.maplen-m->cache.len*sizeof(coeff)),m->cache.maplen);
+	if(m->cache.tmppath) {
+		if(!complete || rename(m->cache.tmppath,m->cache.path))
+			unlink(m->cache.tmppath);
+		free(m->cache.tmppath);
+	}
+	free(m->cache.path);
+}
+
+// set m up to apply the operations of op, with their per-thread state in each of its threads workers
+// expressions are evaluated over rows of exprwidth coeffs, temporal columns when columns is set
+// op's parsed expression is handed to the first worker unless owner is false, when another context already holds it
+static int setup_operators(struct motion_context* m, const struct motion_output* op, int threads, bool columns, size_t exprwidth, bool owner) {
+	const struct coords* block = m->block,* scaled = m->scaled,* active = m->active,* nblocks = m->nblocks;
+	const intermediate* normalization = m->normalization;
+	m->spec = op->spec;
+	m->preserve_dc = op->preserve_dc;
+	m->bandpass = op->bandpass;
+	memcpy(m->boost,op->boost,sizeof(m->boost));
+	memcpy(m->damp,op->damp,sizeof(m->damp));
+	m->quant = op->quant;
+	m->threshold_max = op->threshold_max;
+	m->coeff_limit = op->coeff_limit;
+	m->dithering = op->dithering;
+	if(m->dithering && (m->spec || m->float_pixels || m->deep_pixels)) {
+		fprintf(stderr,"Warning: dithering cannot be used with spectrogram, float, or high bit depth output, disabling.\n");
+		m->dithering = false;
+	}
+
+	size_t maxactive = 0, maxwidth = 0;
+	for(int i = 0; i < m->components; i++) {
+		maxactive = MAX(maxactive,active[i].w*active[i].h*active[i].d);
+		maxwidth = MAX(maxwidth,active[i].w);
+	}
+
+	// a nonzero coeff costs one multiply-add per output pel to synthesize, against about log2 of the block volume for the dense inverse
+	size_t maxsparse = 0;
+	if(!m->spec && !columns && !m->intdct && (m->quant || m->threshold_max || m->coeff_limit))
+		for(int i = 0; i < m->components; i++) {
+			const int adims[3] = {active[i].d,active[i].h,active[i].w}, sdims[3] = {scaled[i].d,scaled[i].h,scaled[i].w};
+			m->sparse[i] = MAX(mi(log2)(scaled[i].w*scaled[i].h*scaled[i].d),1);
+			maxsparse = MAX(maxsparse,m->sparse[i]);
+			for(int a = 0; a < 3; a++) {
+				m->basis[i][a] = malloc(sizeof(coeff)*adims[a]*sdims[a]);
+				for(int k = 0; k < adims[a]; k++)
+					for(int j = 0; j < sdims[a]; j++)
+						m->basis[i][a][k*sdims[a]+j] = (k ? 2 : 1)*mi(cos)(P_PIi*k*(j+mi(0.5))/sdims[a]);
+			}
+		}
+
+	// c and x are the only variables that change along a row, or c and z along a temporal column with --out-of-core or --incremental
+	if(op->expr)
+		m->compiled_expr = motion_expr_compile(op->exprstr,expr_names,columns ? 1 << 0 | 1 << 3 : 1 << 0 | 1 << 1);
+
+	// every worker gets its own expression state, av_expr_eval isn't reentrant for expressions using st()/ld()
+	for(int t = 0; t < threads; t++) {
+		struct motion_worker* w = m->workers+t;
+		if(m->coeff_limit)
+			w->topcoeffs = malloc(sizeof(*w->topcoeffs)*maxactive);
+		if(maxsparse)
+			w->nonzero = malloc(sizeof(*w->nonzero)*maxsparse);
+		if(op->expr) {
+			int err;
+			if(!t && owner)
+				w->expr = op->expr;
+			else if((err = av_expr_parse(&w->expr,op->exprstr,expr_names,NULL,NULL,NULL,NULL,0,NULL)) < 0)
+				return err;
+		}
+		if(m->compiled_expr) {
+			w->exprrow = malloc(sizeof(*w->exprrow)*exprwidth*3);
+			w->exprscratch = malloc(sizeof(*w->exprscratch)*motion_expr_scratch(m->compiled_expr,exprwidth));
+		}
+	}
+
+	for(int i = 0; i < m->components; i++) {
+		if(m->spec == spectype_shift) m->c[i] = mi(127.5)/mi(log1p)(scaled[i].w*scaled[i].h*scaled[i].d*normalization[i]*255*8);
+		m->quantizer[i] = (m->quant*8*mi(sqrt)(scaled[i].w*scaled[i].h*scaled[i].d));
+		m->threshold[i][0] = op->threshold_min*255/normalization[i]/normalization[i];
+		m->threshold[i][1] = op->threshold_max*255/normalization[i]/normalization[i];
+	}
+
+	m->fused = !m->coeff_limit && !op->expr;
+	for(int i = 0; i < m->components; i++) {
+		m->forward[i] = malloc(sizeof(*m->forward[i])*active[i].w);
+		m->inverse[i] = malloc(sizeof(*m->inverse[i])*active[i].w);
+		m->gain[i][0] = malloc(sizeof(*m->gain[i][0])*active[i].w);
+		m->gain[i][1] = malloc(sizeof(*m->gain[i][1])*active[i].w);
+		for(int x = 0; x < active[i].w; x++) {
+			m->forward[i][x] = m->ispec ? 1 : 1/(x ? 1 : P_SQRT2i);
+			m->inverse[i][x] = m->spec ? 1 : (x ? 1 : P_SQRT2i);
+			m->gain[i][0][x] = m->damp[i];
+			m->gain[i][1][x] = x >= m->bandpass.begin[i].w && x < m->bandpass.end[i].w ? m->boost[i] : m->damp[i];
+			if(m->fused) {
+				m->gain[i][0][x] *= m->forward[i][x];
+				m->gain[i][1][x] *= m->forward[i][x];
+			}
+		}
+	}
+
+	uint64_t exprdepends;
+	if(m->compiled_expr && !columns && motion_expr_affine(m->compiled_expr,0,&exprdepends) && !(exprdepends & (1 << 9 | 1 << 10 | 1 << 11))) {
+		double* row = malloc(sizeof(*row)*maxwidth*3);
+		double* scratch = malloc(sizeof(*scratch)*motion_expr_affine_scratch(m->compiled_expr,maxwidth));
+		double* xs = row,* gain = row+maxwidth,* offset = row+maxwidth*2;
+		for(int x = 0; x < maxwidth; x++)
+			xs[x] = x;
+		for(int i = 0; i < m->components; i++) {
+			m->exprgain[i] = malloc(sizeof(*m->exprgain[i])*active[i].w*active[i].h*active[i].d);
+			m->exproffset[i] = malloc(sizeof(*m->exproffset[i])*active[i].w*active[i].h*active[i].d);
+			for(uint64_t z = 0; z < active[i].d; z++)
+				for(int y = 0; y < active[i].h; y++) {
+					double vals[] = {
+						0, 0, y, z, i, block[i].w, block[i].h, block[i].d, m->components,
+						0, 0, 0, nblocks[i].w, nblocks[i].h, block_depth(nblocks->d),
+						0
+					};
+					motion_expr_eval_affine(m->compiled_expr,0,vals,(const double*[]){NULL,xs},active[i].w,scratch,gain,offset);
+					for(int x = 0; x < active[i].w; x++) {
+						m->exprgain[i][(z*active[i].h+y)*active[i].w+x] = gain[x];
+						m->exproffset[i][(z*active[i].h+y)*active[i].w+x] = offset[x]/(normalization[i]*normalization[i])*255;
+					}
+				}
+		}
+		free(scratch);
+		free(row);
+	}
+	return 0;
+}
+
+static void free_operators(struct motion_context* m, int threads) {
+	for(int t = 0; t < threads; t++) {
+		struct motion_worker* w = m->workers+t;
+		free(w->topcoeffs);
+		free(w->nonzero);
+		av_expr_free(w->expr);
+		free(w->exprrow);
+		free(w->exprscratch);
+	}
+	motion_expr_free(m->compiled_expr);
+	for(int i = 0; i < m->components; i++) {
+		free(m->forward[i]);
+		free(m->inverse[i]);
+		free(m->gain[i][0]);
+		free(m->gain[i][1]);
+		free(m->exprgain[i]);
+		free(m->exproffset[i]);
+		for(int a = 0; a < 3; a++)
+			free(m->basis[i][a]);
+	}
+}
+
+// close the outputs opened so far, and free the expressions not yet handed to workers
+static void close_outputs(struct motion_output* outputs, int n) {
+	for(int o = 0; o < n; o++) {
+		av_expr_free(outputs[o].expr);
+		ffapi_close(outputs[o].ctx);
+	}
+}
+
+// plan the 1D pass along axis (0 = d, 1 = h, 2 = w) of a block laid out in minbuf, over extent[] rows of the other axes
+// and howmany blocks dist apart with --batch
+static fftw(plan) plan_pass(int axis, const int extent[3], struct coords minbuf, int howmany, int dist, coeff* coeffs, fftw_r2r_kind kind, int flags) {
+	const int stride[3] = {minbuf.h*minbuf.w,minbuf.w,1};
+	fftw(iodim) dim = {extent[axis],stride[axis],stride[axis]};
+	fftw(iodim) loops[3];
+	int nloops = 0;
+	for(int a = 0; a < 3; a++)
+		if(a != axis)
+			loops[nloops++] = (fftw(iodim)){extent[a],stride[a],stride[a]};
+	loops[nloops++] = (fftw(iodim)){howmany,dist,dist};
+	return fftw(plan_guru_r2r)(1,&dim,nloops,loops,coeffs,coeffs,&kind,flags);
+}
+
+// check the fixed-size kernels against FFTW on a block of noise, to within a few ulps of COEFF_PRECISION per pass
+static bool validate_dct(struct coords block) {
+	const int n = block.w*block.h*block.d;
+	coeff* ref = fftw(alloc_real)(n),* test = fftw(alloc_real)(n);
+	const int dims[3] = {block.d,block.h,block.w};
+	fftw(plan) plans[2] = {
+		fftw(plan_r2r)(3,dims,ref,ref,(const fftw_r2r_kind[3]){FFTW_REDFT10,FFTW_REDFT10,FFTW_REDFT10},FFTW_ESTIMATE),
+		fftw(plan_r2r)(3,dims,ref,ref,(const fftw_r2r_kind[3]){FFTW_REDFT01,FFTW_REDFT01,FFTW_REDFT01},FFTW_ESTIMATE)
+	};
+	bool valid = plans[0] && plans[1];
+	for(int inverse = 0; inverse < 2 && valid; inverse++) {
+		unsigned seed = 1;
+		for(int j = 0; j < n; j++)
+			ref[j] = test[j] = (seed = seed*1103515245+12345) % 65536 / mc(256.0) - 128;
+		fftw(execute)(plans[inverse]);
+		(inverse ? motion_dct_inverse : motion_dct_forward)(test,block.w,block.h,block.d,block.w,block.w*block.h);
+		coeff err = 0, mag = 0;
+		for(int j = 0; j < n; j++) {
+			err = MAX(err,mc(fabs)(test[j]-ref[j]));
+			mag = MAX(mag,mc(fabs)(ref[j]));
+		}
+		valid = err <= mag*COEFF_CONST(EPSILON)*64;
+	}
+	for(int p = 0; p < 2; p++)
+		if(plans[p])
+			fftw(destroy_plan)(plans[p]);
+	fftw(free)(ref);
+	fftw(free)(test);
+	return valid;
+}
+
 int main(int argc, char* argv[]) {
 	int opt;
 	int longoptind = 0;
-	char* infile = NULL,* outfile = NULL,* colorspace = NULL,* iformat = NULL,* format = NULL,* encoder = NULL,* decopts = NULL,* encopts = NULL,* exprstr = NULL,* fftw_wisdom_file = NULL;
+	char* infile = NULL,* colorspace = NULL,* iformat = NULL,* format = NULL,* encoder = NULL,* decopts = NULL,* encopts = NULL,* fftw_wisdom_file = NULL,* scratchdir = NULL,* cachedir = NULL;
 	coords block = {{0,0,1}}, scaled = {0};
 	uint64_t offset = 0, maxframes = 0;
-	int samerate = false, samesize = false, dithering = false, linear = false;
-	enum spectype spec = spectype_none;
+	int samerate = false, samesize = false, linear = false, pipeline = false, batch = false, incremental = false, fftw_pad = false;
 	enum ispectype ispec = ispectype_none;
-	enum preserve_dctype preserve_dc = preserve_dctype_none;
+	enum dcttype dct = dcttype_auto;
+	enum streamtype stream = streamtype_none;
 	AVRational out_rate = {0};
-	range bandpass = {0};
-	coeff boost[4] = {1,1,1,1};
-	coeff damp[4] = {0,0,0,0};
-	intermediate quant = 0;
-	int fftw_flags = FFTW_ESTIMATE, fftw_threads = 1;
+	int fftw_flags = FFTW_ESTIMATE, fftw_threads = 1, threads = 1, nsegments = 1;
 	int loglevel = AV_LOG_ERROR;
+	FFThreadConfig codec_threads = {0};
 	bool quiet = false;
-	coeff threshold_min = 0, threshold_max = 0;
-	size_t coeff_limit = 0;
+	size_t ram_budget = 256;
+	intermediate static_tolerance = -1;
+	const char* checkpoint = NULL;
+	uint64_t checkpoint_interval = 1;
+	int resume = false;
+	// the operations given before the first --output go to the positional outfile and are where every --output starts from
+	struct motion_output outputs[argc],* op = outputs;
+	int noutputs = 1;
+	memset(outputs,0,sizeof(outputs));
+	memcpy(outputs->boost,(coeff[4]){1,1,1,1},sizeof(outputs->boost));
 	const struct option gopts[] = {
 		{"size",required_argument,NULL,'s'},
 		{"blocksize",required_argument,NULL,'b'},
@@ -200,7 +1858,7 @@ int main(int argc, char* argv[]) {
 		{"boost",required_argument,NULL,'B'},
 		{"damp",required_argument,NULL,'D'},
 		{"quant",required_argument,NULL,'q'},
-		{"dither",no_argument,&dithering,1},
+		{"dither",no_argument,NULL,29},
 		{"csp",required_argument,NULL,'c'},
 		{"format",required_argument,NULL,5},
 		{"codec",required_argument,NULL,6},
@@ -219,6 +1877,23 @@ int main(int argc, char* argv[]) {
 		{"coeff-limit",required_argument,NULL,17},
 		{"ispectrogram",optional_argument,NULL,18},
 		{"linear",no_argument,&linear,19},
+		{"threads",required_argument,NULL,20},
+		{"pipeline",no_argument,&pipeline,21},
+		{"batch",no_argument,&batch,22},
+		{"out-of-core",required_argument,NULL,23},
+		{"ram-budget",required_argument,NULL,24},
+		{"incremental",no_argument,&incremental,25},
+		{"dct",required_argument,NULL,26},
+		{"coeff-cache",required_argument,NULL,27},
+		{"output",required_argument,NULL,28},
+		{"segments",required_argument,NULL,30},
+		{"stream",optional_argument,NULL,31},
+		{"static-tolerance",required_argument,NULL,32},
+		{"fftw-pad",no_argument,&fftw_pad,33},
+		{"checkpoint",required_argument,NULL,34},
+		{"checkpoint-interval",required_argument,NULL,35},
+		{"resume",no_argument,&resume,36},
+		{"codec-threads",required_argument,NULL,37},
 		{0}
 	};
 	while((opt = getopt_long(argc,argv,"b:s:p:B:D:c:q:r:P:Qh",gopts,&longoptind)) != -1)
@@ -231,16 +1906,16 @@ int main(int argc, char* argv[]) {
 					exit(1);
 				}
 				break;
-			case 'p': sscanf(optarg,"%" SCNu64 "x%" SCNu64 "x%" SCNu64 "-%" SCNu64 "x%" SCNu64 "x%" SCNu64,&bandpass.begin->w,&bandpass.begin->h,&bandpass.begin->d,&bandpass.end->w,&bandpass.end->h,&bandpass.end->d); break;
-			case 'B': for(int i = sscanf(optarg,"%" COEFF_SPECIFIER ":%" COEFF_SPECIFIER ":%" COEFF_SPECIFIER ":%" COEFF_SPECIFIER,boost,boost+1,boost+2,boost+3); i < 4; i++) boost[i] = i ? boost[i-1] : 1; break;
-			case 'D': for(int i = sscanf(optarg,"%" COEFF_SPECIFIER ":%" COEFF_SPECIFIER ":%" COEFF_SPECIFIER ":%" COEFF_SPECIFIER,damp,damp+1,damp+2,damp+3); i < 4; i++) damp[i] = i ? damp[i-1] : 0; break;
+			case 'p': sscanf(optarg,"%" SCNu64 "x%" SCNu64 "x%" SCNu64 "-%" SCNu64 "x%" SCNu64 "x%" SCNu64,&op->bandpass.begin->w,&op->bandpass.begin->h,&op->bandpass.begin->d,&op->bandpass.end->w,&op->bandpass.end->h,&op->bandpass.end->d); break;
+			case 'B': for(int i = sscanf(optarg,"%" COEFF_SPECIFIER ":%" COEFF_SPECIFIER ":%" COEFF_SPECIFIER ":%" COEFF_SPECIFIER,op->boost,op->boost+1,op->boost+2,op->boost+3); i < 4; i++) op->boost[i] = i ? op->boost[i-1] : 1; break;
+			case 'D': for(int i = sscanf(optarg,"%" COEFF_SPECIFIER ":%" COEFF_SPECIFIER ":%" COEFF_SPECIFIER ":%" COEFF_SPECIFIER,op->damp,op->damp+1,op->damp+2,op->damp+3); i < 4; i++) op->damp[i] = i ? op->damp[i-1] : 0; break;
 			case 'c': colorspace = optarg; break;
 			case 'r': av_parse_video_rate(&out_rate,optarg); break;
 			case  2 : offset = strtoull(optarg,NULL,10); break;
 			case  3 : maxframes = strtoull(optarg,NULL,10); break;
 			case  4 :
-				spec = spectype_abs;
-				if(optarg && !(spec = enum_val(spectype,optarg))) {
+				op->spec = spectype_abs;
+				if(optarg && !(op->spec = enum_val(spectype,optarg))) {
 					fprintf(stderr,"invalid spectrogram type '%s', use one of: %s\n",optarg,enum_keys(spectype));
 					exit(1);
 				}
@@ -255,18 +1930,18 @@ int main(int argc, char* argv[]) {
 			case  5 : format = optarg; break;
 			case  6 : encoder = optarg; break;
 			case  7 : encopts = optarg; break;
-			case 'q': quant = precision_strtoi(optarg,NULL); break;
+			case 'q': op->quant = precision_strtoi(optarg,NULL); break;
 			case  8 : iformat = optarg; break;
 			case  9 : decopts = optarg; break;
 			case 10 : loglevel = strtol(optarg,NULL,10); break;
 			case 11 :
-				preserve_dc = preserve_dctype_dc;
-				if(optarg && !(preserve_dc = enum_val(preserve_dctype,optarg))) {
+				op->preserve_dc = preserve_dctype_dc;
+				if(optarg && !(op->preserve_dc = enum_val(preserve_dctype,optarg))) {
 					fprintf(stderr,"invalid preserve-dc type '%s', use one of: %s\n",optarg,enum_keys(preserve_dctype));
 					exit(1);
 				}
 				break;
-			case 12 : exprstr = optarg; break;
+			case 12 : op->exprstr = optarg; break;
 			case 13 :
 				if((fftw_flags = parse_fftw_flag(optarg)) < 0) {
 					fprintf(stderr, "invalid FFTW flag, use one of: estimate, measure, patient, exhaustive");
@@ -278,8 +1953,60 @@ int main(int argc, char* argv[]) {
 					fprintf(stderr, "invalid number of threads %d\n", fftw_threads);
 					exit(1);
 				}; break;
-			case 16: sscanf(optarg,"%" COEFF_SPECIFIER "-%" COEFF_SPECIFIER, &threshold_min, &threshold_max); break;
-			case 17: coeff_limit = strtoull(optarg,NULL,10); break;
+			case 16: sscanf(optarg,"%" COEFF_SPECIFIER "-%" COEFF_SPECIFIER, &op->threshold_min, &op->threshold_max); break;
+			case 17: op->coeff_limit = strtoull(optarg,NULL,10); break;
+			case 20:
+				if((threads = strtol(optarg,NULL,10)) < 1) {
+					fprintf(stderr, "invalid number of threads %d\n", threads);
+					exit(1);
+				}; break;
+			case 23: scratchdir = optarg; break;
+			case 24:
+				if(!(ram_budget = strtoull(optarg,NULL,10))) {
+					fprintf(stderr, "invalid RAM budget %s\n", optarg);
+					exit(1);
+				}; break;
+			case 26:
+				if(!(dct = enum_val(dcttype,optarg))) {
+					fprintf(stderr,"invalid DCT engine '%s', use one of: %s\n",optarg,enum_keys(dcttype));
+					exit(1);
+				}
+				break;
+			case 27: cachedir = optarg; break;
+			case 28:
+				op = outputs+noutputs++;
+				*op = *outputs;
+				op->file = optarg;
+				break;
+			case 29: op->dithering = true; break;
+			case 30:
+				if((nsegments = strtol(optarg,NULL,10)) < 1) {
+					fprintf(stderr, "invalid number of segments %d\n", nsegments);
+					exit(1);
+				}; break;
+			case 31:
+				stream = streamtype_truncate;
+				if(optarg && !(stream = enum_val(streamtype,optarg))) {
+					fprintf(stderr,"invalid stream type '%s', use one of: %s\n",optarg,enum_keys(streamtype));
+					exit(1);
+				}
+				break;
+			case 32:
+				if((static_tolerance = strtod(optarg,NULL)) < 0) {
+					fprintf(stderr, "invalid static tolerance %s\n", optarg);
+					exit(1);
+				}; break;
+			case 34: checkpoint = optarg; break;
+			case 35:
+				if(!(checkpoint_interval = strtoull(optarg,NULL,10))) {
+					fprintf(stderr, "invalid checkpoint interval %s\n", optarg);
+					exit(1);
+				}; break;
+			case 37:
+				if(ffapi_parse_threads(&codec_threads,optarg)) {
+					fprintf(stderr, "invalid codec threads %s\n", optarg);
+					exit(1);
+				}; break;
 			case  0 : if(gopts[longoptind].flag != NULL) break;
 			case 'Q': quiet = true; break;
 			case 'h': help();
@@ -291,9 +2018,33 @@ int main(int argc, char* argv[]) {
 
 	infile = argv[0];
 	if(argc > 0)
-		outfile = argv[1];
+		outputs->file = argv[1];
+
+	if(!infile || (noutputs > 1 && !outputs->file)) usage();
+
+	// a stream is consumed one temporal block at a time until it ends, without knowing its length up front
+	if(stream) {
+		const char* conflict = !block->d ? "a temporal block size of 0" : pipeline ? "--pipeline" : scratchdir ? "--out-of-core" : incremental ? "--incremental" :
+		                       cachedir ? "--coeff-cache" : nsegments > 1 ? "--segments" : NULL;
+		if(conflict) {
+			fprintf(stderr,"--stream cannot be used with %s\n",conflict);
+			return 1;
+		}
+	}
 
-	if(!infile) usage();
+	// checkpoints are taken between temporal blocks of the plain loop, and resumed by seeking the input
+	if(resume && !checkpoint) {
+		fprintf(stderr,"--resume requires --checkpoint\n");
+		return 1;
+	}
+	if(checkpoint) {
+		const char* conflict = pipeline ? "--pipeline" : scratchdir ? "--out-of-core" : incremental ? "--incremental" : noutputs > 1 ? "--output" :
+		                       nsegments > 1 ? "--segments" : stream ? "--stream" : cachedir ? "--coeff-cache" : NULL;
+		if(conflict) {
+			fprintf(stderr,"--checkpoint cannot be used with %s\n",conflict);
+			return 1;
+		}
+	}
 
 #if LIBAVUTIL_VERSION_INT < AV_VERSION_INT(59,48,100)
 	if(linear) {
@@ -310,6 +2061,11 @@ int main(int argc, char* argv[]) {
 	FFColorProperties color_props;
 	ffapi_parse_color_props(&color_props, colorspace);
 	ffapi_pix_fmt_filter* pix_fmt_filter = ffapi_pixfmts_8bit_or_float_pel;
+	// every output is made from the same pels, so those suit the spectrograms when there are any
+	enum spectype spec = spectype_none;
+	for(int o = 0; o < noutputs; o++)
+		if(outputs[o].spec && (!spec || outputs[o].spec == spectype_flat || outputs[o].spec == spectype_copy))
+			spec = outputs[o].spec;
 	if(spec && color_props.pix_fmt == AV_PIX_FMT_NONE) {
 		if(spec == spectype_flat || spec == spectype_copy)
 			pix_fmt_filter = pixfmts_float_rgb_or_gray;
@@ -323,7 +2079,7 @@ int main(int argc, char* argv[]) {
 	int w[4], h[4];
 	uint64_t nframes;
 	int err;
-	FFContext* in = ffapi_open_input(infile,decopts,iformat,&color_props,pix_fmt_filter,&components,&w,&h,&nframes,&r_frame_rate,!(outfile && maxframes), &err);
+	FFContext* in = ffapi_open_input(infile,decopts,iformat,&color_props,pix_fmt_filter,&components,&w,&h,&nframes,&r_frame_rate,!stream && !(outputs->file && maxframes), &codec_threads, &err);
 	if(!in) {
 		fprintf(stderr, "Error opening \"%s\": %s\n", infile, av_err2str(err));
 		return 1;
@@ -354,7 +2110,9 @@ int main(int argc, char* argv[]) {
 	source->h = *h;
 	AVPixFmtDescriptor pixdesc = *(in->pixdesc);
 
-	if(maxframes) {
+	if(stream)
+		source->d = maxframes ? maxframes : UINT64_MAX;
+	else if(maxframes) {
 		if(source->d && maxframes + offset > source->d) {
 			if(maxframes > source->d) maxframes = source->d;
 			if(offset >= source->d) offset = source->d - maxframes;
@@ -366,11 +2124,17 @@ int main(int argc, char* argv[]) {
 		if(offset >= source->d) offset = source->d - 1;
 		source->d -= offset;
 	}
+	// without --frames a stream's depth stays unknown, UINT64_MAX only bounding the temporal block loop
+	const bool unbounded = stream && !maxframes;
 	coords subsample_factors = {{0,0,0},{pixdesc.log2_chroma_w,pixdesc.log2_chroma_h,0},{pixdesc.log2_chroma_w,pixdesc.log2_chroma_h,0},{0,0,0}};
 	propagate_planes(source,subsample_factors);
-	if(!quiet) { fprintf(stderr,"  source: ");print_coords(source); }
+	if(!quiet) {
+		fprintf(stderr,"  source: ");
+		if(unbounded) print_area(source);
+		else print_coords(source);
+	}
 
-	if(!outfile) {
+	if(!outputs->file) {
 		ffapi_close(in);
 		return 0;
 	}
@@ -396,33 +2160,194 @@ int main(int argc, char* argv[]) {
 
 	propagate_planes(block,subsample_factors);
 	propagate_planes(scaled,subsample_factors);
-	propagate_planes(bandpass.begin,subsample_factors);
-	propagate_planes(bandpass.end,subsample_factors);
+	for(int o = 0; o < noutputs; o++) {
+		propagate_planes(outputs[o].bandpass.begin,subsample_factors);
+		propagate_planes(outputs[o].bandpass.end,subsample_factors);
+	}
 
 	fill_coords(source,block);
 	limit_coords(source,block);
 	fill_coords(block,scaled);
-	fill_coords(block,bandpass.end);
-	limit_coords(block,bandpass.begin);
-	limit_coords(block,bandpass.end);
+	for(int o = 0; o < noutputs; o++) {
+		fill_coords(block,outputs[o].bandpass.end);
+		limit_coords(block,outputs[o].bandpass.begin);
+		limit_coords(block,outputs[o].bandpass.end);
+	}
 
-	if(!quiet && (source->w % block->w || source->h % block->h || source->d % block->d))
+	if(!quiet && (source->w % block->w || source->h % block->h || (!unbounded && source->d % block->d)))
 	 	fprintf(stderr,"Warning: Blocks not evenly divisible, truncating dimensions\n");
 
 	coords nblocks, truncated, newres;
 	for(int i = 0; i < components; i++) {
 		nblocks[i].w = source[i].w / block[i].w;
 		nblocks[i].h = source[i].h / block[i].h;
-		nblocks[i].d = source[i].d / block[i].d;
+		nblocks[i].d = unbounded ? UINT64_MAX : source[i].d / block[i].d;
 
 		newres[i].w = nblocks[i].w * scaled[i].w;
 		newres[i].h = nblocks[i].h * scaled[i].h;
-		newres[i].d = nblocks[i].d * scaled[i].d;
+		newres[i].d = unbounded ? 0 : nblocks[i].d * scaled[i].d;
 
 		truncated[i].w = nblocks[i].w * block[i].w;
 		truncated[i].h = nblocks[i].h * block[i].h;
-		truncated[i].d = nblocks[i].d * block[i].d;
+		truncated[i].d = unbounded ? 0 : nblocks[i].d * block[i].d;
+	}
+
+	// with --fftw-pad the blocks are transformed at the next size along each axis that FFTW is quick with,
+	// from their pels extended symmetrically past the edges, and the bandpass is scaled along with them
+	coords pelblock, pelscaled, padded;
+	memcpy(pelblock,block,sizeof(coords));
+	memcpy(pelscaled,scaled,sizeof(coords));
+	bool padding = false;
+	if(fftw_pad) {
+		const char* conflict = spec ? "--spectrogram" : ispec ? "--ispectrogram" : scratchdir ? "--out-of-core" : incremental ? "--incremental" : dct == dcttype_int ? "--dct int" : NULL;
+		for(int i = 0; i < components && !conflict; i++)
+			if(!match_planes(block[i],scaled[i]))
+				conflict = "--size";
+		if(conflict) {
+			fprintf(stderr,"--fftw-pad cannot be used with %s\n",conflict);
+			ffapi_close(in);
+			return 1;
+		}
+		for(int i = 0; i < components; i++) {
+			padded[i] = (struct coords){smooth_size(block[i].w),smooth_size(block[i].h),smooth_size(block[i].d)};
+			padding |= !match_planes(padded[i],block[i]);
+			for(int o = 0; o < noutputs; o++) {
+				rescale_coords(&outputs[o].bandpass.begin[i],block[i],padded[i]);
+				rescale_coords(&outputs[o].bandpass.end[i],block[i],padded[i]);
+			}
+		}
+		memcpy(block,padded,sizeof(coords));
+		memcpy(scaled,padded,sizeof(coords));
+	}
+
+	// the other modes don't hold on to the forward transformed blocks long enough to filter them more than once
+	if(noutputs > 1) {
+		const char* conflict = pipeline ? "--pipeline" : batch ? "--batch" : scratchdir ? "--out-of-core" : incremental ? "--incremental" : dct == dcttype_int ? "--dct int" : NULL;
+		if(conflict) {
+			fprintf(stderr,"--output cannot be used with %s\n",conflict);
+			ffapi_close(in);
+			return 1;
+		}
+	}
+
+	// the modes checked below only allow a single output
+	const coeff* boost = outputs->boost,* damp = outputs->damp;
+	const range* bandpass = &outputs->bandpass;
+	const size_t coeff_limit = outputs->coeff_limit;
+	if(scratchdir) {
+		const char* conflict = coeff_limit ? "--coeff-limit" : spec ? "--spectrogram" : ispec ? "--ispectrogram" : pipeline ? "--pipeline" : batch ? "--batch" : NULL;
+		for(int i = 0; i < components && !conflict; i++)
+			if(!match_planes(block[i],scaled[i]))
+				conflict = "--size";
+		if(conflict) {
+			fprintf(stderr,"--out-of-core cannot be used with %s\n",conflict);
+			ffapi_close(in);
+			return 1;
+		}
+	}
+
+	// everything past the end of the bandpass has to come out as 0 for the dropped temporal coefficients not to matter
+	if(incremental) {
+		const char* conflict = coeff_limit ? "--coeff-limit" : spec ? "--spectrogram" : ispec ? "--ispectrogram" : pipeline ? "--pipeline" : batch ? "--batch" : scratchdir ? "--out-of-core" : NULL;
+		for(int i = 0; i < components && !conflict; i++)
+			if(!match_planes(block[i],scaled[i]))
+				conflict = "--size";
+			else if(damp[i] != 0)
+				conflict = "--damp other than 0";
+		if(conflict) {
+			fprintf(stderr,"--incremental cannot be used with %s\n",conflict);
+			ffapi_close(in);
+			return 1;
+		}
+	}
+
+	// the integer transform round trips exactly, so only quantization can be applied between
+	if(dct == dcttype_int) {
+		const char* conflict =
+			!ffapi_pixfmts_8bit_pel(in->pixdesc) ? "pixel formats other than 8-bit" : outputs->exprstr ? "--eval" : outputs->threshold_max ? "--threshold" :
+			coeff_limit ? "--coeff-limit" : spec ? "--spectrogram" : ispec ? "--ispectrogram" : outputs->preserve_dc ? "--preserve-dc" :
+			linear ? "--linear" : outputs->dithering ? "--dither" : batch ? "--batch" : scratchdir ? "--out-of-core" : incremental ? "--incremental" : NULL;
+		for(int i = 0; i < components && !conflict; i++)
+			if(!match_planes(block[i],scaled[i]))
+				conflict = "--size";
+			else if(!motion_dct_supported(block[i].w,block[i].h,block[i].d))
+				conflict = "block dimensions other than 1, 2, 4, 8, or 16";
+			else if(bandpass->begin[i].w || bandpass->begin[i].h || bandpass->begin[i].d || !match_planes(bandpass->end[i],block[i]) || boost[i] != 1)
+				conflict = "--bandpass or --boost";
+		if(conflict) {
+			fprintf(stderr,"--dct int cannot be used with %s\n",conflict);
+			ffapi_close(in);
+			return 1;
+		}
+		motion_intdct_init();
+	}
+
+	// static blocks are picked out from the pels of a whole block before its forward transform
+	if(static_tolerance >= 0) {
+		const char* conflict = ispec ? "--ispectrogram" : batch ? "--batch" : scratchdir ? "--out-of-core" : incremental ? "--incremental" : dct == dcttype_int ? "--dct int" : NULL;
+		if(conflict) {
+			fprintf(stderr,"--static-tolerance cannot be used with %s\n",conflict);
+			ffapi_close(in);
+			return 1;
+		}
+	}
+
+	struct stat inputstat;
+	if(cachedir) {
+		const char* conflict = ispec ? "--ispectrogram" : batch ? "--batch" : scratchdir ? "--out-of-core" : incremental ? "--incremental" : dct == dcttype_int ? "--dct int" : NULL;
+		if(conflict || stat(infile,&inputstat) || !S_ISREG(inputstat.st_mode)) {
+			if(conflict)
+				fprintf(stderr,"--coeff-cache cannot be used with %s\n",conflict);
+			else
+				fprintf(stderr,"--coeff-cache requires the input to be a regular file\n");
+			ffapi_close(in);
+			return 1;
+		}
+	}
+
+	// each segment decodes its own run of temporal blocks from a seek, so the input can't be a stream
+	if(nsegments > 1) {
+		const char* conflict = pipeline ? "--pipeline" : scratchdir ? "--out-of-core" : incremental ? "--incremental" : noutputs > 1 ? "--output" : NULL;
+		struct stat st;
+		if(conflict || !strcmp(infile,"-") || !strncmp(infile,"pipe:",5) || (!stat(infile,&st) && S_ISFIFO(st.st_mode))) {
+			if(conflict)
+				fprintf(stderr,"--segments cannot be used with %s\n",conflict);
+			else
+				fprintf(stderr,"--segments requires a seekable input\n");
+			ffapi_close(in);
+			return 1;
+		}
+		nsegments = MIN(nsegments,MAX(nblocks->d,1));
+	}
+
+	// the out-of-core and incremental paths transform the temporal axis separately, which the fixed-size kernels don't cover
+	if(dct == dcttype_fixed && (scratchdir || incremental)) {
+		fprintf(stderr,"--dct fixed cannot be used with %s\n",scratchdir ? "--out-of-core" : "--incremental");
+		ffapi_close(in);
+		return 1;
+	}
+
+	// the fixed-size kernels cover blocks transformed whole at the same size, checked against FFTW before being trusted
+	bool fixed[4] = {false};
+	if(dct != dcttype_fftw && dct != dcttype_int && !scratchdir && !incremental) {
+		motion_dct_init();
+		for(int i = 0; i < components; i++) {
+			if(!match_planes(block[i],scaled[i]) || !motion_dct_supported(block[i].w,block[i].h,block[i].d))
+				continue;
+			bool shared = false;
+			for(int j = 0; j < i && !shared; j++)
+				if(match_planes(block[i],block[j]) && match_planes(scaled[j],block[j]))
+					fixed[i] = fixed[j], shared = true;
+			if(!shared && !(fixed[i] = validate_dct(block[i])) && !quiet)
+				fprintf(stderr,"Warning: fixed-size DCT for %" PRIu64 "x%" PRIu64 "x%" PRIu64 " blocks doesn't match FFTW, using FFTW.\n",block[i].w,block[i].h,block[i].d);
+		}
 	}
+	for(int i = 0; i < components; i++)
+		if(dct == dcttype_fixed && !fixed[i]) {
+			fprintf(stderr,"--dct fixed requires blocks the same size as the output with dimensions of 1, 2, 4, 8, or 16\n");
+			ffapi_close(in);
+			return 1;
+		}
 
 	if(out_rate.num == 0 && out_rate.den == 0) {
 		AVRational scale = {1,1};
@@ -433,23 +2358,41 @@ int main(int argc, char* argv[]) {
 	else r_frame_rate = out_rate;
 
 	if(!quiet) {
-		fprintf(stderr,"   using: ");print_coords(truncated);
-		fprintf(stderr,"   block: ");print_coords(block);
-		fprintf(stderr,"bp begin: ");print_coords(bandpass.begin);
-		fprintf(stderr,"bp   end: ");print_coords(bandpass.end);
-		fprintf(stderr,"  scaled: ");print_coords(scaled);
-		fprintf(stderr," nblocks: ");print_coords(nblocks);
-		fprintf(stderr," outsize: ");print_coords(newres);
+		fprintf(stderr,"   using: ");
+		if(unbounded) print_area(truncated);
+		else print_coords(truncated);
+		fprintf(stderr,"   block: ");print_coords(pelblock);
+		if(padding) { fprintf(stderr,"  padded: ");print_coords(block); }
+		fprintf(stderr,"bp begin: ");print_coords(bandpass->begin);
+		fprintf(stderr,"bp   end: ");print_coords(bandpass->end);
+		fprintf(stderr,"  scaled: ");print_coords(pelscaled);
+		fprintf(stderr," nblocks: ");
+		if(unbounded) print_area(nblocks);
+		else print_coords(nblocks);
+		fprintf(stderr," outsize: ");
+		if(unbounded) print_area(newres);
+		else print_coords(newres);
 		fprintf(stderr,"\n");
 	}
 
 	// Setup output
-	FFContext* out = ffapi_open_output(outfile,encopts,format,encoder,AV_CODEC_ID_FFV1,&color_props,newres->w,newres->h,r_frame_rate, &err);
-	if(!out) {
-		fprintf(stderr,"Output setup failed for '%s' / '%s': %s\n",outfile,format,av_err2str(err));
-		ffapi_close(in);
-		return 1;
-	}
+	for(int o = 0; o < noutputs; o++)
+		if(!(outputs[o].ctx = ffapi_open_output(outputs[o].file,encopts,format,encoder,AV_CODEC_ID_FFV1,&color_props,newres->w,newres->h,r_frame_rate, &codec_threads, &err))) {
+			fprintf(stderr,"Output setup failed for '%s' / '%s': %s\n",outputs[o].file,format,av_err2str(err));
+			close_outputs(outputs,o);
+			ffapi_close(in);
+			return 1;
+		}
+	// segments and checkpoints are appended to the output rather than written to it
+	if(nsegments == 1 && !checkpoint)
+		for(int o = 0; o < noutputs; o++)
+			if((err = ffapi_write_behind(outputs[o].ctx,FFAPI_WRITE_BEHIND))) {
+				fprintf(stderr,"Error starting output thread for '%s': %s\n",outputs[o].file,av_err2str(err));
+				close_outputs(outputs,noutputs);
+				ffapi_close(in);
+				return 1;
+			}
+	FFContext* out = outputs->ctx;
 
 	if(!quiet) {
 		fprintf(stderr,"pixel_format %s --> %s --> %s\n",av_get_pix_fmt_name(in->codec->pix_fmt),pixdesc.name,av_get_pix_fmt_name(out->codec->pix_fmt));
@@ -460,33 +2403,48 @@ int main(int argc, char* argv[]) {
 		fprintf(stderr,"chroma_sample_location %s --> %s --> %s\n",av_chroma_location_name(in->codec->chroma_sample_location),av_chroma_location_name(color_props.chroma_location),av_chroma_location_name(out->codec->chroma_sample_location));
 	}
 
-	AVExpr* expr = NULL;
-	const char* names[] = {"c","x","y","z","i","width","height","depth","components","bx","by","bz","bwidth","bheight","bdepth",NULL};
-	if(exprstr && av_expr_parse(&expr,exprstr,names,NULL,NULL,NULL,NULL,0,NULL) < 0) {
-		ffapi_close(in);
-		ffapi_close(out);
-		return 1;
+	// the segments are joined by copying packets, which only stand alone when every frame is a keyframe
+	if(nsegments > 1 || checkpoint) {
+		const AVCodecDescriptor* desc = avcodec_descriptor_get(out->codec->codec_id);
+		if(!desc || !(desc->props & AV_CODEC_PROP_INTRA_ONLY)) {
+			fprintf(stderr,"%s requires an intra-only encoder, not %s\n",checkpoint ? "--checkpoint" : "--segments",desc ? desc->name : "unknown");
+			ffapi_close(in);
+			close_outputs(outputs,noutputs);
+			return 1;
+		}
 	}
 
-	// Seeking
-	if(offset) {
-		err = ffapi_seek_frame(in, &offset, quiet ? NULL : seek_progress);
-		if(err) {
-			fprintf(stderr,"Error seeking: %s\n",av_err2str(err));
+	for(int o = 0; o < noutputs; o++)
+		if(outputs[o].exprstr && av_expr_parse(&outputs[o].expr,outputs[o].exprstr,expr_names,NULL,NULL,NULL,NULL,0,NULL) < 0) {
 			ffapi_close(in);
-			ffapi_close(out);
+			close_outputs(outputs,noutputs);
 			return 1;
 		}
-		if(!quiet)
-			fprintf(stderr,"\n");
-	}
+
 	// Main loop
 
 	fftw(init_threads)();
 	fftw(plan_with_nthreads)(fftw_threads);
 
-	coords minbuf, active;
-	size_t mincomponent = 0;
+	struct motion_context m = {
+		.components = components,
+		.linear = linear,
+		.ispec = ispec,
+		.input_trc = input_trc,
+		.output_trc = output_trc,
+	};
+	memcpy(m.block,block,sizeof(coords));
+	memcpy(m.scaled,scaled,sizeof(coords));
+	memcpy(m.pelblock,pelblock,sizeof(coords));
+	memcpy(m.pelscaled,pelscaled,sizeof(coords));
+	memcpy(m.nblocks,nblocks,sizeof(coords));
+	memcpy(m.fixed,fixed,sizeof(fixed));
+	m.intdct = dct == dcttype_int;
+	m.stream = stream;
+	m.static_tolerance = static_tolerance;
+
+	struct coords* minbuf = m.minbuf,* active = m.active;
+	size_t mincomponent = 0, maxactive = 0, maxwidth = 0;
 	for(int i = 0; i < components; i++) {
 		minbuf[i].w = MAX(block[i].w,scaled[i].w);
 		minbuf[i].h = MAX(block[i].h,scaled[i].h);
@@ -496,59 +2454,312 @@ int main(int argc, char* argv[]) {
 		active[i].d = MIN(block[i].d,scaled[i].d);
 
 		if(minbuf[i].w*minbuf[i].h*minbuf[i].d > mincomponent) mincomponent = minbuf[i].w*minbuf[i].h*minbuf[i].d;
+		if(active[i].w*active[i].h*active[i].d > maxactive) maxactive = active[i].w*active[i].h*active[i].d;
+		maxwidth = MAX(maxwidth,active[i].w);
 	}
-	coeff* coeffs = fftw(alloc_real)(mincomponent);
+	m.mincomponent = mincomponent;
 
-	bool float_pixels = in->pixdesc->flags & AV_PIX_FMT_FLAG_FLOAT;
-	void** pixels[components];
-	for(int i = 0; i < components; i++) {
-		pixels[i] = malloc(sizeof(*pixels)*nblocks[i].w*nblocks[i].h);
-		for(int b = 0; b < nblocks[i].h * nblocks[i].w; b++)
-			if(float_pixels)
-				pixels[i][b] = malloc(sizeof(float)*minbuf[i].w*minbuf[i].h*minbuf[i].d);
+	if(cachedir) {
+		for(int i = 0; i < components; i++) {
+			m.cache.offset[i] = m.cache.stride;
+			m.cache.stride += nblocks[i].w*nblocks[i].h*active[i].w*active[i].h*active[i].d;
+		}
+		m.cache.len = m.cache.stride*nblocks->d;
+
+		// everything that goes into the forward transform of the blocks
+		char* path = realpath(infile,NULL);
+		char key[4096];
+		int keylen = snprintf(key,sizeof(key),"%s\n%lld.%09ld %lld\n%s\n%s\n%s\n%s\n%" PRIu64 " %" PRIu64 "\n%d %d %zu %g\n",
+		                      path ? path : infile,(long long)inputstat.st_mtim.tv_sec,inputstat.st_mtim.tv_nsec,(long long)inputstat.st_size,
+		                      iformat ? iformat : "",decopts ? decopts : "",colorspace ? colorspace : "",pixdesc.name,offset,nblocks->d*pelblock->d,
+		                      linear,components,sizeof(coeff),(double)static_tolerance);
+		free(path);
+		for(int i = 0; i < components && keylen < sizeof(key); i++)
+			keylen += snprintf(key+keylen,sizeof(key)-keylen,"%" PRIu64 "x%" PRIu64 "x%" PRIu64 " %" PRIu64 "x%" PRIu64 "x%" PRIu64 " %" PRIu64 "x%" PRIu64 "\n",
+			                   block[i].w,block[i].h,block[i].d,scaled[i].w,scaled[i].h,scaled[i].d,nblocks[i].w,nblocks[i].h);
+		if(keylen >= sizeof(key) || (err = open_coeff_cache(&m,cachedir,key))) {
+			fprintf(stderr,"Error creating coefficient cache in '%s': %s\n",cachedir,keylen >= sizeof(key) ? "key too long" : strerror(err));
+			ffapi_close(in);
+			close_outputs(outputs,noutputs);
+			return 1;
+		}
+		if(!quiet)
+			fprintf(stderr,m.cache.hit ? "   cache: reading %s\n" : "   cache: writing %s\n",m.cache.path);
+	}
+
+	// a resumed checkpoint picks up at the first temporal block not in a complete segment
+	uint64_t first = 0;
+	if(checkpoint) {
+		// the parsed settings that determine the output, so it doesn't matter how the options were spelled or ordered
+		char* manifest = NULL;
+		size_t manifestlen;
+		FILE* f = open_memstream(&manifest,&manifestlen);
+		uint64_t done;
+		if(f) {
+			const struct motion_output* op = outputs;
+			char* path = realpath(infile,NULL);
+			fprintf(f,"%s\n%s\n%s\n%s\n%s %d %d\n%" PRIu64 " %" PRIu64 "\n%s\n%s\n%d/%d %" PRIu64 "\n%g\n",
+			        path ? path : infile,iformat ? iformat : "",decopts ? decopts : "",colorspace ? colorspace : "",pixdesc.name,linear,dct,
+			        offset,nblocks->d*pelblock->d,out->codec->codec->name,encopts ? encopts : "",r_frame_rate.num,r_frame_rate.den,checkpoint_interval,
+			        (double)static_tolerance);
+			free(path);
+			for(int i = 0; i < components; i++)
+				fprintf(f,"%" PRIu64 "x%" PRIu64 "x%" PRIu64 " %" PRIu64 "x%" PRIu64 "x%" PRIu64 " %" PRIu64 "x%" PRIu64 "x%" PRIu64 " %" PRIu64 "x%" PRIu64 "x%" PRIu64 " %" PRIu64 "x%" PRIu64 "x%" PRIu64 " %g %g\n",
+				        pelblock[i].w,pelblock[i].h,pelblock[i].d,block[i].w,block[i].h,block[i].d,scaled[i].w,scaled[i].h,scaled[i].d,
+				        op->bandpass.begin[i].w,op->bandpass.begin[i].h,op->bandpass.begin[i].d,op->bandpass.end[i].w,op->bandpass.end[i].h,op->bandpass.end[i].d,
+				        (double)op->boost[i],(double)op->damp[i]);
+			fprintf(f,"%zu\n%d %d %d %g %g %g %zu %d\n%s\n",sizeof(coeff),ispec,op->spec,op->preserve_dc,(double)op->quant,(double)op->threshold_min,(double)op->threshold_max,
+			        op->coeff_limit,op->dithering,op->exprstr ? op->exprstr : "");
+			err = fclose(f) ? errno : open_checkpoint(checkpoint,manifest,resume,&done);
+		}
+		else err = errno;
+		free(manifest);
+		if(err) {
+			if(err < 0)
+				fprintf(stderr,"Checkpoint in '%s' was started with different options\n",checkpoint);
 			else
-				pixels[i][b] = malloc(minbuf[i].w*minbuf[i].h*minbuf[i].d);
+				fprintf(stderr,"Error opening checkpoint in '%s': %s\n",checkpoint,strerror(err));
+			ffapi_close(in);
+			close_outputs(outputs,noutputs);
+			return 1;
+		}
+		first = MIN(done*checkpoint_interval,nblocks->d);
+		if(!quiet && first)
+			fprintf(stderr,"  resume: temporal block %" PRIu64 " of %" PRIu64 "\n",first,nblocks->d);
+	}
+
+	// Seeking, which a cache hit doesn't need since the input isn't read, and segments do on their own inputs
+	if((first ? first < nblocks->d : offset) && !m.cache.hit && nsegments == 1) {
+		err = first ? ffapi_seek_to_frame(in,offset+first*pelblock->d) : ffapi_seek_frame(in, &offset, quiet ? NULL : seek_progress);
+		if(err) {
+			fprintf(stderr,"Error seeking: %s\n",av_err2str(err));
+			close_coeff_cache(&m,false);
+			ffapi_close(in);
+			close_outputs(outputs,noutputs);
+			return 1;
+		}
+		if(!quiet)
+			fprintf(stderr,"\n");
+	}
+	if(!m.cache.hit && nsegments == 1 && (err = ffapi_read_ahead(in,FFAPI_READ_AHEAD))) {
+		fprintf(stderr,"Error starting input thread: %s\n",av_err2str(err));
+		close_coeff_cache(&m,false);
+		ffapi_close(in);
+		close_outputs(outputs,noutputs);
+		return 1;
+	}
+
+	if(scratchdir) {
+		for(int i = 0; i < components; i++) {
+			m.ooc.plane[i] = truncated[i].w*truncated[i].h;
+			m.ooc.offset[i] = m.ooc.len;
+			m.ooc.len += m.ooc.plane[i]*block[i].d;
+		}
+		// the file is unlinked right away so it goes away with the process
+		char* path = malloc(strlen(scratchdir)+sizeof("/motion-XXXXXX"));
+		sprintf(path,"%s/motion-XXXXXX",scratchdir);
+		int fd = mkstemp(path);
+		if(fd >= 0)
+			unlink(path);
+		if(fd < 0 || ftruncate(fd,m.ooc.len*sizeof(coeff)) ||
+		   (m.ooc.map = mmap(NULL,m.ooc.len*sizeof(coeff),PROT_READ|PROT_WRITE,MAP_SHARED,fd,0)) == MAP_FAILED) {
+			fprintf(stderr,"Error creating scratch file in '%s': %s\n",scratchdir,strerror(errno));
+			if(fd >= 0)
+				close(fd);
+			free(path);
+			ffapi_close(in);
+			close_outputs(outputs,noutputs);
+			return 1;
+		}
+		close(fd);
+		free(path);
+	}
+
+	if(incremental) {
+		m.incremental.nbands = bandpass->end->d;
+		for(int i = 0; i < components; i++) {
+			m.incremental.plane[i] = truncated[i].w*truncated[i].h;
+			m.incremental.offset[i] = m.incremental.len;
+			m.incremental.len += m.incremental.plane[i]*m.incremental.nbands;
+		}
+		if(!(m.incremental.bands = malloc(sizeof(coeff)*m.incremental.len))) {
+			fprintf(stderr,"Error allocating %zu temporal bands\n",(size_t)m.incremental.nbands);
+			ffapi_close(in);
+			close_outputs(outputs,noutputs);
+			return 1;
+		}
+
+		// unnormalized like FFTW's REDFT10 and REDFT01 so filter_column sees the same scale as with a 3D plan
+		const uint64_t depth = block->d, nbands = m.incremental.nbands;
+		m.incremental.forward = malloc(sizeof(coeff)*depth*nbands);
+		m.incremental.inverse = malloc(sizeof(coeff)*depth*nbands);
+		for(uint64_t z = 0; z < depth; z++)
+			for(uint64_t k = 0; k < nbands; k++) {
+				intermediate w = 2*mi(cos)(P_PIi*k*(z+mi(0.5))/depth);
+				m.incremental.forward[z*nbands+k] = w;
+				m.incremental.inverse[z*nbands+k] = k ? w : 1;
+			}
+	}
+
+	struct motion_pool* pool = motion_pool_create(threads);
+	if(!pool) {
+		fprintf(stderr,"Error creating worker threads\n");
+		ffapi_close(in);
+		close_outputs(outputs,noutputs);
+		return 1;
+	}
+	threads = motion_pool_threads(pool);
+	m.workers = calloc(threads,sizeof(*m.workers));
+
+	m.batch = batch;
+
+	// with --batch each worker holds a whole row of blocks back to back
+	size_t scratch = mincomponent, maxrow = 0;
+	if(batch)
+		for(int i = 0; i < components; i++) {
+			if(nblocks[i].w*minbuf[i].w*minbuf[i].h*minbuf[i].d > scratch)
+				scratch = nblocks[i].w*minbuf[i].w*minbuf[i].h*minbuf[i].d;
+			maxrow = MAX(maxrow,nblocks[i].w);
+		}
+
+	// with --out-of-core each worker holds either one 2D block or a tile of temporal columns, the tile sized to fit the budget
+	size_t exprwidth = maxwidth, maxarea = 0;
+	if(scratchdir || incremental)
+		for(int i = 0; i < components; i++)
+			maxarea = MAX(maxarea,block[i].w*block[i].h);
+	if(scratchdir) {
+		size_t maxplane = 0;
+		for(int i = 0; i < components; i++)
+			maxplane = MAX(maxplane,m.ooc.plane[i]);
+		m.ooc.tile = MIN(MAX(ram_budget*1024*1024/(threads*block->d*sizeof(coeff)),1),maxplane);
+		scratch = MAX(maxarea,m.ooc.tile*block->d);
+		exprwidth = block->d;
+	}
+	// with --incremental each worker holds one 2D block or the retained coefficients of one temporal column
+	else if(incremental) {
+		scratch = MAX(maxarea,m.incremental.nbands);
+		exprwidth = m.incremental.nbands;
 	}
 
-	if(dithering && (spec || float_pixels)) {
-		fprintf(stderr,"Warning: dithering cannot be used with spectrogram or float output, disabling.\n");
-		dithering = false;
+	// every worker gets its own scratch, the state of the operations is set up with them below
+	for(int t = 0; t < threads; t++) {
+		struct motion_worker* w = m.workers+t;
+		w->coeffs = fftw(alloc_real)(scratch);
+		if(batch)
+			w->dc = malloc(sizeof(*w->dc)*maxrow);
+		if(noutputs > 1)
+			w->packed = malloc(sizeof(*w->packed)*maxactive);
+		if(m.intdct)
+			w->ints = malloc(sizeof(*w->ints)*mincomponent);
+		if(scratchdir || incremental)
+			w->pels = malloc(sizeof(float)*maxarea);
 	}
+	coeff* coeffs = m.workers->coeffs;
+
+	m.float_pixels = in->pixdesc->flags & AV_PIX_FMT_FLAG_FLOAT;
+	m.deep_pixels = ffapi_pixfmts_16bit_pel(in->pixdesc);
+	m.pelsize = m.float_pixels ? sizeof(float) : m.deep_pixels ? sizeof(uint16_t) : 1;
+	for(int i = 0; i < components; i++)
+		m.pelmax[i] = (1 << in->pixdesc->comp[i].depth)-1;
+	m.pixdesc = &pixdesc;
+	m.pool = pool;
+
+	// the pipeline keeps one temporal block decoding, one transforming, and one encoding
+	struct motion_pipeline p = { .m = &m, .in = in, .out = out };
+	int nslabs = pipeline ? PIPELINE_SLABS : scratchdir || incremental ? 0 : 1;
+	for(int s = 0; s < nslabs; s++)
+		p.slabs[s] = alloc_pixels(&m);
 
 	if(fftw_wisdom_file)
 		fftw(import_wisdom_from_filename)(fftw_wisdom_file);
 
+	// plans are created against the first worker's buffer and executed on each worker's own with the new-array interface
+	// the inverse is needed unless every output is a spectrogram
+	bool inverse = false;
+	for(int o = 0; o < noutputs; o++)
+		inverse |= !outputs[o].spec;
 	int unique_plans = 0;
-	fftw(plan) plans[components*2];
-	fftw(plan) planforward[components];
-	fftw(plan) planinverse[components];
-	for(int i = 0; i < components; i++) {
+	fftw(plan) plans[components*8+2];
+	fftw(plan)* planforward = m.planforward;
+	fftw(plan)* planinverse = m.planinverse;
+	if(scratchdir || incremental) {
+		// separable: 2D per frame, then 1D along z over each tile of columns, or by the precomputed weights with --incremental
+		for(int i = 0; i < components; i++) {
+			plans[unique_plans++] = planforward[i] = fftw(plan_r2r_2d)(block[i].h,block[i].w,coeffs,coeffs,FFTW_REDFT10,FFTW_REDFT10,fftw_flags);
+			plans[unique_plans++] = planinverse[i] = fftw(plan_r2r_2d)(block[i].h,block[i].w,coeffs,coeffs,FFTW_REDFT01,FFTW_REDFT01,fftw_flags);
+		}
+		if(scratchdir) {
+			int depth = block->d;
+			plans[unique_plans++] = m.ooc.temporal[0] = fftw(plan_many_r2r)(1,&depth,m.ooc.tile,coeffs,NULL,1,depth,coeffs,NULL,1,depth,(const fftw_r2r_kind[1]){FFTW_REDFT10},fftw_flags);
+			plans[unique_plans++] = m.ooc.temporal[1] = fftw(plan_many_r2r)(1,&depth,m.ooc.tile,coeffs,NULL,1,depth,coeffs,NULL,1,depth,(const fftw_r2r_kind[1]){FFTW_REDFT01},fftw_flags);
+		}
+	}
+	else for(int i = 0; i < components; i++) {
+		int howmany = batch ? nblocks[i].w : 1;
+		int dist = batch ? minbuf[i].w*minbuf[i].h*minbuf[i].d : 0;
+		const int bdims[3] = {block[i].d,block[i].h,block[i].w}, adims[3] = {active[i].d,active[i].h,active[i].w}, sdims[3] = {scaled[i].d,scaled[i].h,scaled[i].w};
+		if(fixed[i] || m.intdct)
+			continue;
 		if(!ispec) {
-			planforward[i] = NULL;
-			for(int j = 0; j < i; j++)
-				if(match_planes(block[i],block[j]) && match_planes(minbuf[i],minbuf[j])) {
+			bool shared = false;
+			for(int j = 0; j < i && !shared; j++)
+				if(match_planes(block[i],block[j]) && match_planes(minbuf[i],minbuf[j]) && match_planes(active[i],active[j]) && (!batch || nblocks[i].w == nblocks[j].w)) {
 					planforward[i] = planforward[j];
-					break;
+					memcpy(m.pruneforward[i],m.pruneforward[j],sizeof(m.pruneforward[i]));
+					shared = true;
 				}
-			if(!planforward[i])
+			// when shrinking only the active corner of the output is kept, so each pass after the first along w
+			// only runs over the rows that are inside active along the axes already transformed
+			if(!shared && !match_planes(block[i],active[i]))
+				for(int p = 0; p < 3; p++) {
+					int axis = 2-p, extent[3];
+					for(int a = 0; a < 3; a++)
+						extent[a] = a > axis ? adims[a] : bdims[a];
+					plans[unique_plans++] = m.pruneforward[i][p] = plan_pass(axis,extent,minbuf[i],howmany,dist,coeffs,FFTW_REDFT10,fftw_flags);
+				}
+			else if(!shared)
 				plans[unique_plans++] = planforward[i] =
-					fftw(plan_many_r2r)(3,(const int[3]){block[i].d,block[i].h,block[i].w},1,
-						coeffs,(const int[3]){minbuf[i].d,minbuf[i].h,minbuf[i].w},1,0,
-						coeffs,(const int[3]){minbuf[i].d,minbuf[i].h,minbuf[i].w},1,0,
+					fftw(plan_many_r2r)(3,(const int[3]){block[i].d,block[i].h,block[i].w},howmany,
+						coeffs,(const int[3]){minbuf[i].d,minbuf[i].h,minbuf[i].w},1,dist,
+						coeffs,(const int[3]){minbuf[i].d,minbuf[i].h,minbuf[i].w},1,dist,
 						(const fftw_r2r_kind[3]){FFTW_REDFT10,FFTW_REDFT10,FFTW_REDFT10},fftw_flags);
 		}
-		if(!spec) {
-			planinverse[i] = NULL;
-			for(int j = 0; j < i; j++)
-				if(match_planes(scaled[i],scaled[j]) && match_planes(minbuf[i],minbuf[j])) {
+		if(inverse) {
+			bool shared = false;
+			for(int j = 0; j < i && !shared; j++)
+				if(match_planes(scaled[i],scaled[j]) && match_planes(minbuf[i],minbuf[j]) && match_planes(active[i],active[j]) && (!batch || nblocks[i].w == nblocks[j].w)) {
 					planinverse[i] = planinverse[j];
-					break;
+					memcpy(m.pruneinverse[i],m.pruneinverse[j],sizeof(m.pruneinverse[i]));
+					shared = true;
 				}
-			if(!planinverse[i])
+			// when enlarging everything outside active is 0, so the passes along d and h only run over the rows
+			// that are inside active along the axes not yet transformed
+			if(!shared && !match_planes(scaled[i],active[i]))
+				for(int axis = 0; axis < 3; axis++) {
+					int extent[3];
+					for(int a = 0; a < 3; a++)
+						extent[a] = a > axis ? adims[a] : sdims[a];
+					plans[unique_plans++] = m.pruneinverse[i][axis] = plan_pass(axis,extent,minbuf[i],howmany,dist,coeffs,FFTW_REDFT01,fftw_flags);
+				}
+			else if(!shared)
 				plans[unique_plans++] = planinverse[i] =
-					fftw(plan_many_r2r)(3,(const int[3]){scaled[i].d,scaled[i].h,scaled[i].w},1,
-						coeffs,(const int[3]){minbuf[i].d,minbuf[i].h,minbuf[i].w},1,0,
-						coeffs,(const int[3]){minbuf[i].d,minbuf[i].h,minbuf[i].w},1,0,
+					fftw(plan_many_r2r)(3,(const int[3]){scaled[i].d,scaled[i].h,scaled[i].w},howmany,
+						coeffs,(const int[3]){minbuf[i].d,minbuf[i].h,minbuf[i].w},1,dist,
+						coeffs,(const int[3]){minbuf[i].d,minbuf[i].h,minbuf[i].w},1,dist,
+						(const fftw_r2r_kind[3]){FFTW_REDFT01,FFTW_REDFT01,FFTW_REDFT01},fftw_flags);
+		}
+		// static blocks are transformed as a block of depth 1
+		if(static_tolerance >= 0 && block[i].d > 1) {
+			plans[unique_plans++] = m.staticforward[i] =
+				fftw(plan_many_r2r)(3,(const int[3]){1,block[i].h,block[i].w},1,
+					coeffs,(const int[3]){1,minbuf[i].h,minbuf[i].w},1,0,
+					coeffs,(const int[3]){1,minbuf[i].h,minbuf[i].w},1,0,
+					(const fftw_r2r_kind[3]){FFTW_REDFT10,FFTW_REDFT10,FFTW_REDFT10},fftw_flags);
+			if(inverse)
+				plans[unique_plans++] = m.staticinverse[i] =
+					fftw(plan_many_r2r)(3,(const int[3]){1,scaled[i].h,scaled[i].w},1,
+						coeffs,(const int[3]){1,minbuf[i].h,minbuf[i].w},1,0,
+						coeffs,(const int[3]){1,minbuf[i].h,minbuf[i].w},1,0,
 						(const fftw_r2r_kind[3]){FFTW_REDFT01,FFTW_REDFT01,FFTW_REDFT01},fftw_flags);
 		}
 	}
@@ -556,290 +2767,313 @@ int main(int argc, char* argv[]) {
 	if(fftw_wisdom_file)
 		fftw(export_wisdom_to_filename)(fftw_wisdom_file);
 
-	intermediate scalefactor[components];
-	intermediate normalization[components];
-	intermediate c[components];
-	intermediate ic[components];
-	coeff quantizer[components];
-	coeff threshold[components][2];
 	for(int i = 0; i < components; i++) {
-		scalefactor[i] = (scaled[i].w*scaled[i].h*scaled[i].d)/(intermediate)(block[i].w*block[i].h*block[i].d);
-		normalization[i] = 1/mi(sqrt)(scaled[i].w*scaled[i].h*scaled[i].d*8);
-		if(spec == spectype_shift) c[i] = mi(127.5)/mi(log1p)(scaled[i].w*scaled[i].h*scaled[i].d*normalization[i]*255*8);
-		if(ispec == ispectype_shift) ic[i] = mi(127.5)/mi(log1p)(scaled[i].w*scaled[i].h*scaled[i].d*normalization[i]*255*8);
-		quantizer[i] = (quant*8*mi(sqrt)(scaled[i].w*scaled[i].h*scaled[i].d));
-		threshold[i][0] = threshold_min*255/normalization[i]/normalization[i];
-		threshold[i][1] = threshold_max*255/normalization[i]/normalization[i];
+		m.scalefactor[i] = (scaled[i].w*scaled[i].h*scaled[i].d)/(intermediate)(block[i].w*block[i].h*block[i].d);
+		m.normalization[i] = 1/mi(sqrt)(scaled[i].w*scaled[i].h*scaled[i].d*8);
+		if(ispec == ispectype_shift) m.ic[i] = mi(127.5)/mi(log1p)(scaled[i].w*scaled[i].h*scaled[i].d*m.normalization[i]*255*8);
 	}
 
-	coeff** topcoeffs;
-	coeff* topcoefftmp;
-	coeff_limit = MIN(coeff_limit,mincomponent);
-	size_t sortbuf_len = MIN(coeff_limit*3,mincomponent-coeff_limit);
-	if(coeff_limit) {
-		topcoeffs = malloc(sizeof(*topcoeffs)*(coeff_limit+sortbuf_len));
-		topcoefftmp = malloc(sizeof(*topcoefftmp)*coeff_limit);
+	// the outputs after the first share everything but the operations, which start out unset in these copies
+	m.nextra = noutputs-1;
+	m.extra = calloc(MAX(m.nextra,1),sizeof(*m.extra));
+	for(int o = 0; o < m.nextra; o++) {
+		struct motion_context* x = m.extra+o;
+		*x = m;
+		x->extra = NULL;
+		x->nextra = 0;
+		x->workers = calloc(threads,sizeof(*x->workers));
+		x->pixels = alloc_pixels(x);
+		x->progress.quiet = true;
 	}
 
-	int padb = log10f(source->d)+1, pads = log10f(newres->d)+1;
-	if(!quiet)
-		fprintf(stderr,"read: %*d wrote: %*d",padb,0,pads,0);
-	AVFrame* readframe = ffapi_alloc_frame(in);
-	AVFrame* writeframe = ffapi_alloc_frame(out);
+	// segments share the plans with the main context, but run their blocks on their own pool with their own scratch
 	int ret = 0;
-	unsigned long long coeffs_coded = 0;
-	for(uint64_t bz = 0; bz < nblocks->d; bz++) {
-		for(uint64_t z = 0; z < block->d; z++) {
-			if((err = ffapi_read_frame(in,readframe))) {
-				fprintf(stderr,"Error reading frame: %s\n",av_err2str(err));
+	struct motion_segment* segments = nsegments > 1 ? calloc(nsegments,sizeof(*segments)) : NULL;
+	for(int k = 0; segments && k < nsegments; k++) {
+		struct motion_segment* s = segments+k;
+		s->m = m;
+		s->m.extra = NULL;
+		s->m.nextra = 0;
+		s->m.progress.quiet = true;
+		s->parent = &m;
+		s->begin = nblocks->d*k/nsegments;
+		s->end = nblocks->d*(k+1)/nsegments;
+		if(!(s->m.pool = motion_pool_create(threads))) {
+			fprintf(stderr,"Error creating worker threads\n");
+			ret = 1;
+			goto end;
+		}
+		s->threads = motion_pool_threads(s->m.pool);
+		s->m.workers = calloc(s->threads,sizeof(*s->m.workers));
+		for(int t = 0; t < s->threads; t++) {
+			struct motion_worker* w = s->m.workers+t;
+			w->coeffs = fftw(alloc_real)(scratch);
+			if(batch)
+				w->dc = malloc(sizeof(*w->dc)*maxrow);
+			if(m.intdct)
+				w->ints = malloc(sizeof(*w->ints)*mincomponent);
+		}
+		s->m.pixels = alloc_pixels(&s->m);
+	}
+
+	err = setup_operators(&m,outputs,threads,scratchdir || incremental,exprwidth,true);
+	for(int o = 0; o < m.nextra && !err; o++)
+		err = setup_operators(m.extra+o,outputs+o+1,threads,false,exprwidth,true);
+	for(int k = 0; segments && k < nsegments && !err; k++)
+		err = setup_operators(&segments[k].m,outputs,segments[k].threads,false,exprwidth,false);
+	if(err) {
+		fprintf(stderr,"Error setting up operations: %s\n",av_err2str(err));
+		ret = 1;
+		goto end;
+	}
+
+	m.progress.quiet = quiet;
+	m.progress.padb = stream ? 0 : log10f(source->d)+1;
+	m.progress.pads = stream ? 0 : log10f(newres->d)+1;
+	pthread_mutex_init(&m.progress.lock,NULL);
+	if(!quiet)
+		fprintf(stderr,"read: %*d wrote: %*d",m.progress.padb,0,m.progress.pads,0);
+	if(pipeline) {
+		if((err = run_pipeline(&p)))
+			ret = 1;
+	}
+	else if(scratchdir || incremental) {
+		AVFrame* readframe = ffapi_alloc_frame(in);
+		AVFrame* writeframe = ffapi_alloc_frame(out);
+		for(uint64_t bz = 0; bz < nblocks->d; bz++) {
+			if(incremental)
+				memset(m.incremental.bands,0,sizeof(coeff)*m.incremental.len);
+			if((err = scratchdir ?
+			          transform_frames(&m,in,out,readframe,writeframe,bz,ooc_forward_frame,ooc_temporal,ooc_tiles,ooc_inverse_frame) :
+			          transform_frames(&m,in,out,readframe,writeframe,bz,incremental_accumulate,incremental_filter,NULL,incremental_synthesize))) {
+				fprintf(stderr,"\nError processing frame: %s\n",av_err2str(err));
+				ret = 1;
+				break;
+			}
+		}
+		ffapi_free_frame(readframe);
+		ffapi_free_frame(writeframe);
+	}
+	else if(segments) {
+		const char* tmpdir = getenv("TMPDIR");
+		if(!tmpdir || !*tmpdir)
+			tmpdir = "/tmp";
+		for(int k = 0; k < nsegments && !ret; k++) {
+			struct motion_segment* s = segments+k;
+			FFColorProperties segment_props;
+			ffapi_parse_color_props(&segment_props,colorspace);
+			if(!(s->in = ffapi_open_input(infile,decopts,iformat,&segment_props,pix_fmt_filter,NULL,NULL,NULL,NULL,NULL,false,&codec_threads,&err)) ||
+			   (!m.cache.hit && ((err = ffapi_seek_to_frame(s->in,offset+s->begin*pelblock->d)) || (err = ffapi_read_ahead(s->in,FFAPI_READ_AHEAD))))) {
+				fprintf(stderr,"\nError opening segment %d of \"%s\": %s\n",k,infile,av_err2str(err));
+				ret = 1;
+				break;
+			}
+			// the temporary file only has to hold the packets until they're appended, nut takes any codec
+			s->path = malloc(strlen(tmpdir)+sizeof("/motion-XXXXXX"));
+			sprintf(s->path,"%s/motion-XXXXXX",tmpdir);
+			int fd = mkstemp(s->path);
+			if(fd < 0) {
+				fprintf(stderr,"\nError creating segment file in '%s': %s\n",tmpdir,strerror(errno));
+				free(s->path);
+				s->path = NULL;
 				ret = 1;
-				goto end;
+				break;
 			}
-			for(int i = 0; i < components; i++) {
-				if(bz >= nblocks[i].d || z >= block[i].d) continue;
-				AVComponentDescriptor comp = pixdesc.comp[i];
-				for(int by = 0; by < nblocks[i].h; by++)
-					for(int bx = 0; bx < nblocks[i].w; bx++)
-						for(int y = 0; y < block[i].h; y++)
-							for(int x = 0; x < block[i].w; x++)
-								if(float_pixels)
-									((float*)pixels[i][by*nblocks[i].w+bx])[(z*minbuf[i].h+y)*minbuf[i].w+x] = ffapi_getpelf(in,readframe,bx*block[i].w+x,by*block[i].h+y,i);
-								else
-									((unsigned char*)pixels[i][by*nblocks[i].w+bx])[(z*minbuf[i].h+y)*minbuf[i].w+x] = ffapi_getpel_direct(readframe,bx*block[i].w+x,by*block[i].h+y,comp);
+			close(fd);
+			if(!(s->out = ffapi_open_output(s->path,encopts,"nut",out->codec->codec->name,AV_CODEC_ID_FFV1,&color_props,newres->w,newres->h,r_frame_rate,&codec_threads,&err)) ||
+			   (err = ffapi_write_behind(s->out,FFAPI_WRITE_BEHIND))) {
+				fprintf(stderr,"\nError opening segment file '%s': %s\n",s->path,av_err2str(err));
+				ret = 1;
+				break;
 			}
-			if(!quiet)
-				fprintf(stderr,"\rread: %*" PRIu64 " wrote: %*" PRIu64,padb,bz*block->d+z+1,pads,bz*scaled->d);
 		}
-		for(int i = 0; i < components; i++) {
-			if(bz >= nblocks[i].d) continue;
-			for(int b = 0; b < nblocks[i].h * nblocks[i].w; b++) {
-				void* pblock = pixels[i][b];
-				memset(coeffs,0,sizeof(coeff)*mincomponent);
-				for(uint64_t z = 0; z < block[i].d; z++)
-					for(int y = 0; y < block[i].h; y++)
-						for(int x = 0; x < block[i].w; x++) {
-							intermediate pel;
-							if(float_pixels)
-								pel = ((float*)pblock)[(z*minbuf[i].h+y)*minbuf[i].w+x]*255;
-							else
-								pel = ((unsigned char*)pblock)[(z*minbuf[i].h+y)*minbuf[i].w+x];
-
-							switch(ispec) {
-								case ispectype_shift: pel = mi(copysign)((mi(expm1)(mi(fabs)((pel-mi(127.5))/ic[i]))),pel-mi(127.5))/normalization[i]; break;
-								case ispectype_flat:  pel = (pel-mi(127.5))*2/normalization[i]/normalization[i]; break;
-								case ispectype_copy:  pel = pel/normalization[i]/normalization[i]; break;
-								case ispectype_none:
-									if(linear)
-										pel = input_trc(pel/255)*255;
-									break;
-							}
-
-							coeffs[(z*minbuf[i].h+y)*minbuf[i].w+x] = pel;
-						}
-
-				if(!ispec) {
-					fftw(execute)(planforward[i]);
-
-					// normalize coeffs to uniform range
-					for(uint64_t z = 0; z < active[i].d; z++)
-						for(int y = 0; y < active[i].h; y++)
-							for(int x = 0; x < active[i].w; x++)
-								coeffs[(z*minbuf[i].h+y)*minbuf[i].w+x] *= 2*P_SQRT2i / ((x ? 1 : P_SQRT2i) * (y ? 1 : P_SQRT2i) * (z ? 1 : P_SQRT2i));
-				}
-
-				coeff dc = coeffs[0];
-
-				if(coeff_limit) {
-					size_t j;
-					for(j = 0; j < coeff_limit; j++)
-						topcoeffs[j] = coeffs+j;
-					coeff** sortbuf = topcoeffs + coeff_limit;
-					for(; j < mincomponent; j += sortbuf_len) {
-						size_t k;
-						for(k = 0; k < MIN(sortbuf_len, mincomponent-j); k++)
-							sortbuf[k] = coeffs+j+k;
-						qsort(topcoeffs,coeff_limit+k,sizeof(*topcoeffs),sortcoeffs);
-					}
-					for(j = 0; j < coeff_limit; j++)
-						topcoefftmp[j] = *topcoeffs[j];
-					memset(coeffs,0,sizeof(*coeffs)*mincomponent);
-					for(j = 0; j < coeff_limit; j++)
-						*topcoeffs[j] = topcoefftmp[j];
-				}
-
-				if(expr)
-					for(uint64_t z = 0; z < active[i].d; z++)
-						for(int y = 0; y < active[i].h; y++)
-							for(int x = 0; x < active[i].w; x++) {
-								double vals[] = {
-									coeffs[(z*minbuf[i].h+y)*minbuf[i].w+x]*normalization[i]*normalization[i]/255,
-									x, y, z, i, block[i].w, block[i].h, block[i].d, components,
-									b%nblocks[i].w, b/nblocks[i].h, bz, nblocks[i].w, nblocks[i].h, nblocks->d,
-									0
-								};
-								coeffs[(z*minbuf[i].h+y)*minbuf[i].w+x] = av_expr_eval(expr,vals,NULL)/(normalization[i]*normalization[i])*255;
-							}
-
-				if(damp[i] != 1) {
-					if(bandpass.begin[i].d) // front
-						for(uint64_t z = 0; z < bandpass.begin[i].d; z++)
-							for(int y = 0; y < active[i].h; y++)
-								for(int x = 0; x < active[i].w; x++)
-									coeffs[(z*minbuf[i].h+y)*minbuf[i].w+x] *= damp[i];
-					if(bandpass.end[i].d < active[i].d) // back
-						for(uint64_t z = bandpass.end[i].d; z < active[i].d; z++)
-							for(int y = 0; y < active[i].h; y++)
-								for(int x = 0; x < active[i].w; x++)
-									coeffs[(z*minbuf[i].h+y)*minbuf[i].w+x] *= damp[i];
-					if(bandpass.begin[i].h) // top
-						for(uint64_t z = bandpass.begin[i].d; z < bandpass.end[i].d; z++)
-							for(int y = 0; y < bandpass.begin[i].h; y++)
-								for(int x = 0; x < active[i].w; x++)
-									coeffs[(z*minbuf[i].h+y)*minbuf[i].w+x] *= damp[i];
-					if(bandpass.end[i].h < active[i].h) // bottom
-						for(uint64_t z = bandpass.begin[i].d; z < bandpass.end[i].d; z++)
-							for(int y = bandpass.end[i].h; y < active[i].h; y++)
-								for(int x = 0; x < active[i].w; x++)
-									coeffs[(z*minbuf[i].h+y)*minbuf[i].w+x] *= damp[i];
-					if(bandpass.begin[i].w) // left
-						for(uint64_t z = bandpass.begin[i].d; z < bandpass.end[i].d; z++)
-							for(int y = bandpass.begin[i].h; y < bandpass.end[i].h; y++)
-								for(int x = 0; x < bandpass.begin[i].w; x++)
-									coeffs[(z*minbuf[i].h+y)*minbuf[i].w+x] *= damp[i];
-					if(bandpass.end[i].w < active[i].w) //right
-						for(uint64_t z = bandpass.begin[i].d; z < bandpass.end[i].d; z++)
-							for(int y = bandpass.begin[i].h; y < bandpass.end[i].h; y++)
-								for(int x = bandpass.end[i].w; x < active[i].w; x++)
-									coeffs[(z*minbuf[i].h+y)*minbuf[i].w+x] *= damp[i];
-				}
-				if(boost[i] != 1)
-					for(uint64_t z = bandpass.begin[i].d; z < bandpass.end[i].d; z++)
-						for(int y = bandpass.begin[i].h; y < bandpass.end[i].h; y++)
-							for(int x = bandpass.begin[i].w; x < bandpass.end[i].w; x++)
-								coeffs[(z*minbuf[i].h+y)*minbuf[i].w+x] *= boost[i];
-
-				if(threshold_max)
-					for(uint64_t z = 0; z < active[i].d; z++)
-						for(int y = 0; y < active[i].h; y++)
-							for(int x = 0; x < active[i].w; x++) {
-								coeff c = mc(fabs)(coeffs[(z*minbuf[i].h+y)*minbuf[i].w+x]);
-								if(c < threshold[i][0] || c > threshold[i][1])
-									coeffs[(z*minbuf[i].h+y)*minbuf[i].w+x] = 0;
-							}
-
-				if(preserve_dc) {
-					bool dcstop = bandpass.begin[i].d || bandpass.begin[i].h || bandpass.begin[i].w;
-					if(expr || dcstop || boost[i] != 1 || threshold_max) {
-						if(preserve_dc == preserve_dctype_dc)
-							coeffs[0] = dc;
-						else if(preserve_dc == preserve_dctype_grey)
-							coeffs[0] += (1-(dcstop ? damp[i] : boost[i])) * mi(127.5)/(normalization[i]*normalization[i]*scalefactor[i]);
-					}
-				}
-
-				if(quant)
-					for(uint64_t z = 0; z < active[i].d; z++)
-						for(int y = 0; y < active[i].h; y++)
-							for(int x = 0; x < active[i].w; x++)
-								coeffs_coded += !!(coeffs[(z*minbuf[i].h+y)*minbuf[i].w+x] = mi(round)(coeffs[(z*minbuf[i].h+y)*minbuf[i].w+x] / quantizer[i])*quantizer[i]);
-
-				if(!spec) {
-					// reverse uniform range normalization before inverting
-					for(uint64_t z = 0; z < active[i].d; z++)
-						for(int y = 0; y < active[i].h; y++)
-							for(int x = 0; x < active[i].w; x++)
-								coeffs[(z*minbuf[i].h+y)*minbuf[i].w+x] *= ((x ? 1 : P_SQRT2i) * (y ? 1 : P_SQRT2i) * (z ? 1 : P_SQRT2i)) / (2*P_SQRT2i);
-
-					fftw(execute)(planinverse[i]);
-				}
-				else if(spec == spectype_abs) c[i] = 255/mi(log1p)(mi(fabs)(dc * scalefactor[i] * normalization[i]));
-				for(uint64_t z = 0; z < scaled[i].d; z++)
-					for(int y = 0; y < scaled[i].h; y++)
-						for(int x = 0; x < scaled[i].w; x++) {
-							intermediate pel = coeffs[(z*minbuf[i].h+y)*minbuf[i].w+x] * scalefactor[i] * normalization[i];
-
-							switch(spec) {
-								case spectype_abs:   pel = c[i]*mi(log1p)(mi(fabs)(pel)); break;
-								case spectype_shift: pel = c[i]*mi(copysign)(mi(log1p)(mi(fabs)(pel)),pel)+mi(127.5); break;
-								case spectype_flat:  pel = pel*normalization[i]/2+mi(127.5); break;
-								case spectype_copy:
-								case spectype_none:
-									pel *= normalization[i];
-									if(linear)
-										pel = output_trc(pel/255)*255;
-									break;
-							}
-
-							if(float_pixels)
-								((float*)pblock)[(z*minbuf[i].h+y)*minbuf[i].w+x] = pel/255;
-							else
-								((unsigned char*)pblock)[(z*minbuf[i].h+y)*minbuf[i].w+x] = pel > 255 ? 255 : pel < 0 ? 0 : mi(lround)(pel);
-
-							if(dithering) {
-								unsigned char p = ((unsigned char*)pblock)[(z*minbuf[i].h+y)*minbuf[i].w+x];
-								intermediate dp = coeffs[(z*minbuf[i].h+y)*minbuf[i].w+x]-p/(normalization[i]*normalization[i]*scalefactor[i]);
-								if(x < scaled[i].w-1) coeffs[(z*minbuf[i].h+y)*minbuf[i].w+x+1] += dp*7/16;
-								if(y < scaled[i].h-1) {
-									if(x) coeffs[(z*minbuf[i].h+y+1)*minbuf[i].w+x-1] += dp*3/16;
-									coeffs[(z*minbuf[i].h+y+1)*minbuf[i].w+x] += dp*5/16;
-									if(x < scaled[i].w-1) coeffs[(z*minbuf[i].h+y+1)*minbuf[i].w+x+1] += dp/16;
-								}
-							}
-						}
+		for(int k = 0; k < nsegments && !ret; k++)
+			if(!(segments[k].started = !pthread_create(&segments[k].thread,NULL,run_segment,segments+k)))
+				run_segment(segments+k);
+		for(int k = 0; k < nsegments; k++) {
+			struct motion_segment* s = segments+k;
+			if(s->started)
+				pthread_join(s->thread,NULL);
+			if(s->out && (err = ffapi_close(s->out)) && !s->err) {
+				fprintf(stderr,"\nError finishing segment file '%s': %s\n",s->path,av_err2str(err));
+				s->err = err;
 			}
+			s->out = NULL;
+			ret |= !!s->err;
+			for(int t = 0; t < s->threads; t++)
+				m.workers->coeffs_coded += s->m.workers[t].coeffs_coded;
 		}
-		for(uint64_t z = 0; z < scaled->d; z++) {
-			for(int i = 0; i < components; i++) {
-				if(bz >= nblocks[i].d || z >= scaled[i].d) continue;
-				AVComponentDescriptor comp = pixdesc.comp[i];
-				for(int by = 0; by < nblocks[i].h; by++)
-					for(int bx = 0; bx < nblocks[i].w; bx++)
-						for(int y = 0; y < scaled[i].h; y++)
-							for(int x = 0; x < scaled[i].w; x++)
-								if(float_pixels)
-									ffapi_setpelf(out,writeframe,bx*scaled[i].w+x,by*scaled[i].h+y,i,((float*)pixels[i][by*nblocks[i].w+bx])[(z*minbuf[i].h+y)*minbuf[i].w+x]);
-								else
-									ffapi_setpel_direct(writeframe,bx*scaled[i].w+x,by*scaled[i].h+y,comp,((unsigned char*)pixels[i][by*nblocks[i].w+bx])[(z*minbuf[i].h+y)*minbuf[i].w+x]);
+		for(int k = 0; k < nsegments && !ret; k++)
+			if((err = ffapi_append(out,segments[k].path))) {
+				fprintf(stderr,"\nError joining segment file '%s': %s\n",segments[k].path,av_err2str(err));
+				ret = 1;
+			}
+	}
+	else {
+		AVFrame* readframe = ffapi_alloc_frame(in);
+		for(int o = 0; o < noutputs; o++)
+			outputs[o].frame = ffapi_alloc_frame(outputs[o].ctx);
+		FFContext* segment = NULL;
+		char* segmentpath = NULL;
+		for(uint64_t bz = first; bz < nblocks->d; bz++) {
+			if(checkpoint && !segment) {
+				segmentpath = checkpoint_path(checkpoint,bz/checkpoint_interval,true);
+				if(!(segment = ffapi_open_output(segmentpath,encopts,"nut",out->codec->codec->name,AV_CODEC_ID_FFV1,&color_props,newres->w,newres->h,r_frame_rate,&codec_threads,&err)) ||
+				   (err = ffapi_write_behind(segment,FFAPI_WRITE_BEHIND))) {
+					fprintf(stderr,"\nError opening checkpoint segment '%s': %s\n",segmentpath,av_err2str(err));
+					ret = 1;
+					break;
+				}
+			}
+			if((err = read_block(&m,in,readframe,p.slabs[0],bz))) {
+				// a stream ends with the first temporal block it can't fill, or the one after it was padded
+				if(err == AVERROR_EOF && stream)
+					break;
+				fprintf(stderr,"\nError reading frame: %s\n",av_err2str(err));
+				ret = 1;
+				break;
 			}
-			if((err = ffapi_write_frame(out,writeframe))) {
-				fprintf(stderr,"Error writing frame: %s\n",av_err2str(err));
+			transform_blocks(&m,p.slabs[0],bz);
+			for(int o = 0; o < noutputs && !err; o++)
+				err = o ? write_block(m.extra+o-1,outputs[o].ctx,outputs[o].frame,m.extra[o-1].pixels,bz) :
+				          write_block(&m,segment ? segment : out,outputs->frame,p.slabs[0],bz);
+			if(err) {
+				fprintf(stderr,"\nError writing frame: %s\n",av_err2str(err));
 				ret = 1;
-				goto end;
+				break;
+			}
+			// the segment only counts once it's renamed into place
+			if(segment && ((bz+1) % checkpoint_interval == 0 || bz+1 == nblocks->d)) {
+				char* path = checkpoint_path(checkpoint,bz/checkpoint_interval,false);
+				err = ffapi_close(segment);
+				segment = NULL;
+				if(err || rename(segmentpath,path)) {
+					fprintf(stderr,"\nError finishing checkpoint segment '%s': %s\n",segmentpath,err ? av_err2str(err) : strerror(errno));
+					unlink(segmentpath);
+					ret = 1;
+				}
+				free(path);
+				free(segmentpath);
+				segmentpath = NULL;
+				if(ret)
+					break;
+			}
+		}
+		if(segment) {
+			ffapi_close(segment);
+			unlink(segmentpath);
+		}
+		free(segmentpath);
+		ffapi_free_frame(readframe);
+		for(int o = 0; o < noutputs; o++)
+			ffapi_free_frame(outputs[o].frame);
+
+		if(checkpoint && !ret) {
+			const uint64_t nfiles = (nblocks->d+checkpoint_interval-1)/checkpoint_interval;
+			for(uint64_t n = 0; n < nfiles && !ret; n++) {
+				char* path = checkpoint_path(checkpoint,n,false);
+				if((err = ffapi_append(out,path))) {
+					fprintf(stderr,"\nError joining checkpoint segment '%s': %s\n",path,av_err2str(err));
+					ret = 1;
+				}
+				free(path);
 			}
-			if(!quiet)
-				fprintf(stderr,"\rread: %*" PRIu64 " wrote: %*" PRIu64,padb,(bz+1)*block->d,pads,bz*scaled->d+z+1);
+			if(!ret)
+				close_checkpoint(checkpoint,nfiles);
 		}
 	}
+	if(ret)
+		goto end;
 	fprintf(stderr,"\n");
 
-	if(quant) {
-		unsigned long long total = 0;
+	if(static_tolerance >= 0 && !quiet) {
+		unsigned long long static_blocks = 0, total = 0;
+		for(int t = 0; t < threads; t++)
+			static_blocks += m.workers[t].static_blocks;
+		for(int k = 0; segments && k < nsegments; k++)
+			for(int t = 0; t < segments[k].threads; t++)
+				static_blocks += segments[k].m.workers[t].static_blocks;
 		for(int i = 0; i < components; i++)
-			total += newres[i].w * newres[i].h * newres[i].d;
-		if(!quiet)
-			fprintf(stderr,"coeffs: %llu / %llu (%2.0f%%)\nzeroes: %llu / %llu (%2.0f%%)\n",coeffs_coded,total,coeffs_coded*100.0/total,total-coeffs_coded,total,(total-coeffs_coded)*100.0/total);
+			if(block[i].d > 1)
+				total += nblocks[i].w * nblocks[i].h * (stream ? m.progress.read/pelblock[i].d : nblocks[i].d);
+		fprintf(stderr,"static: %llu / %llu blocks (%2.0f%%)\n",static_blocks,total,total ? static_blocks*100.0/total : 0);
+	}
+
+	for(int o = 0; o < noutputs; o++) {
+		const struct motion_context* x = o ? m.extra+o-1 : &m;
+		if(!outputs[o].quant || quiet)
+			continue;
+		unsigned long long total = 0, coeffs_coded = 0;
+		for(int t = 0; t < threads; t++)
+			coeffs_coded += x->workers[t].coeffs_coded;
+		for(int i = 0; i < components; i++)
+			total += newres[i].w * newres[i].h * (stream ? m.progress.wrote : newres[i].d);
+		if(noutputs > 1)
+			fprintf(stderr,"%s:\n",outputs[o].file);
+		fprintf(stderr,"coeffs: %llu / %llu (%2.0f%%)\nzeroes: %llu / %llu (%2.0f%%)\n",coeffs_coded,total,coeffs_coded*100.0/total,total-coeffs_coded,total,(total-coeffs_coded)*100.0/total);
 	}
 
 end:
-	fftw(free)(coeffs);
-	for(int i = 0; i < components; i++) {
-		for(int b = 0; b < nblocks[i].h * nblocks[i].w; b++)
-			free(pixels[i][b]);
-		free(pixels[i]);
+	motion_pool_destroy(pool);
+	free_operators(&m,threads);
+	for(int t = 0; t < threads; t++) {
+		struct motion_worker* w = m.workers+t;
+		fftw(free)(w->coeffs);
+		free(w->dc);
+		free(w->packed);
+		free(w->ints);
+		free(w->pels);
+	}
+	for(int o = 0; o < m.nextra; o++) {
+		free_operators(m.extra+o,threads);
+		free(m.extra[o].workers);
+		free_pixels(m.extra+o,m.extra[o].pixels);
+	}
+	free(m.extra);
+	for(int k = 0; segments && k < nsegments; k++) {
+		struct motion_segment* s = segments+k;
+		ffapi_close(s->in);
+		ffapi_close(s->out);
+		if(s->path) {
+			unlink(s->path);
+			free(s->path);
+		}
+		if(!s->m.pool)
+			continue;
+		free_operators(&s->m,s->threads);
+		for(int t = 0; t < s->threads; t++) {
+			fftw(free)(s->m.workers[t].coeffs);
+			free(s->m.workers[t].dc);
+			free(s->m.workers[t].ints);
+		}
+		free(s->m.workers);
+		free_pixels(&s->m,s->m.pixels);
+		motion_pool_destroy(s->m.pool);
 	}
+	free(segments);
+	if(m.ooc.map)
+		munmap(m.ooc.map,m.ooc.len*sizeof(coeff));
+	if(cachedir)
+		close_coeff_cache(&m,!ret);
+	free(m.incremental.bands);
+	free(m.incremental.forward);
+	free(m.incremental.inverse);
+	free(m.workers);
+	for(int s = 0; s < nslabs; s++)
+		free_pixels(&m,p.slabs[s]);
+	pthread_mutex_destroy(&m.progress.lock);
 	for(int i = 0; i < unique_plans; i++)
 		fftw(destroy_plan)(plans[i]);
 	fftw(cleanup)();
 
-	ffapi_close(out);
+	for(int o = 0; o < noutputs; o++)
+		if((err = ffapi_close(outputs[o].ctx)) && !ret) {
+			fprintf(stderr,"Error finishing output '%s': %s\n",outputs[o].file,av_err2str(err));
+			ret = 1;
+		}
 	ffapi_close(in);
 
 	fftw(cleanup_threads)();
 
-	if(coeff_limit) {
-		free(topcoefftmp);
-		free(topcoeffs);
-	}
-
 	return ret;
 }
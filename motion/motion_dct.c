@@ -0,0 +1,306 @@
+/*
+ * motion - apply various 2- or 3-dimensional frequency-domain operations to an image or video.
+ */
+
+#include "motion_dct.h"
+
+#include <math.h>
+
+#define MIN(x,y) ((x) < (y) ? (x) : (y))
+
+// 1D transforms run on LANES independent rows at once so each butterfly is a vector operation
+#define LANES 8
+typedef coeff lanes[LANES];
+
+// 1/(2cos(pi*(n+0.5)/N)) at [N/2+n] for the butterflies of size N
+static coeff twiddle[16];
+
+void motion_dct_init(void) {
+	for(int h = 1; h < 16; h *= 2)
+		for(int n = 0; n < h; n++)
+			twiddle[h+n] = 1/(2*mi(cos)(P_PIi*(n+mi(0.5))/(2*h)));
+}
+
+bool motion_dct_supported(int w, int h, int d) {
+	const int dims[3] = {w,h,d};
+	for(int a = 0; a < 3; a++)
+		if(dims[a] < 1 || dims[a] > 16 || dims[a] & (dims[a]-1))
+			return false;
+	return true;
+}
+
+// Lee's recursive factorization, each size splitting into two transforms of half the size
+// forward outputs are scaled by s, inverse outputs by s with the dc input additionally scaled by dc
+static inline void dct2_1(lanes* x, coeff s) {
+	for(int l = 0; l < LANES; l++)
+		x[0][l] *= s;
+}
+
+static inline void dct3_1(lanes* x, coeff s, coeff dc) {
+	for(int l = 0; l < LANES; l++)
+		x[0][l] *= s*dc;
+}
+
+#define DCT_KERNELS(N,H)\
+	static inline void dct2_##N(lanes* x, coeff s) {\
+		lanes u[H], v[H];\
+		for(int n = 0; n < H; n++)\
+			for(int l = 0; l < LANES; l++) {\
+				u[n][l] = s*(x[n][l]+x[N-1-n][l]);\
+				v[n][l] = s*twiddle[H+n]*(x[n][l]-x[N-1-n][l]);\
+			}\
+		dct2_##H(u,1);\
+		dct2_##H(v,1);\
+		for(int k = 0; k < H; k++)\
+			for(int l = 0; l < LANES; l++) {\
+				x[2*k][l] = u[k][l];\
+				x[2*k+1][l] = k < H-1 ? v[k][l]+v[k+1][l] : v[k][l];\
+			}\
+	}\
+	static inline void dct3_##N(lanes* x, coeff s, coeff dc) {\
+		lanes u[H], v[H];\
+		for(int k = 0; k < H; k++)\
+			for(int l = 0; l < LANES; l++) {\
+				u[k][l] = x[2*k][l];\
+				v[k][l] = k ? x[2*k+1][l]+x[2*k-1][l] : x[1][l];\
+			}\
+		dct3_##H(u,1,dc);\
+		dct3_##H(v,1,1);\
+		for(int n = 0; n < H; n++)\
+			for(int l = 0; l < LANES; l++) {\
+				coeff t = twiddle[H+n]*v[n][l];\
+				x[n][l] = s*(u[n][l]+t);\
+				x[N-1-n][l] = s*(u[n][l]-t);\
+			}\
+	}
+
+DCT_KERNELS(2,1)
+DCT_KERNELS(4,2)
+DCT_KERNELS(8,4)
+DCT_KERNELS(16,8)
+
+// transform n elements stride apart along each of count rows lanestride apart
+static void dct_pass(coeff* data, int n, ptrdiff_t stride, size_t count, ptrdiff_t lanestride, bool inverse) {
+	// a size 1 REDFT10 doubles its input and a size 1 REDFT01 is the identity
+	if(n == 1) {
+		if(!inverse)
+			for(size_t l = 0; l < count; l++)
+				data[l*lanestride] *= 2;
+		return;
+	}
+
+	lanes x[16];
+	for(size_t l0 = 0; l0 < count; l0 += LANES) {
+		const size_t nl = MIN(LANES,count-l0);
+		coeff* base = data+l0*lanestride;
+		for(int k = 0; k < n; k++) {
+			for(size_t l = 0; l < nl; l++)
+				x[k][l] = base[k*stride+l*lanestride];
+			for(size_t l = nl; l < LANES; l++)
+				x[k][l] = 0;
+		}
+		// the factor of 2 in FFTW's definitions is applied at the top level, and REDFT01 weighs the dc input by half
+		if(inverse)
+			switch(n) {
+				case  2: dct3_2(x,2,mc(0.5));  break;
+				case  4: dct3_4(x,2,mc(0.5));  break;
+				case  8: dct3_8(x,2,mc(0.5));  break;
+				case 16: dct3_16(x,2,mc(0.5)); break;
+			}
+		else
+			switch(n) {
+				case  2: dct2_2(x,2);  break;
+				case  4: dct2_4(x,2);  break;
+				case  8: dct2_8(x,2);  break;
+				case 16: dct2_16(x,2); break;
+			}
+		for(int k = 0; k < n; k++)
+			for(size_t l = 0; l < nl; l++)
+				base[k*stride+l*lanestride] = x[k][l];
+	}
+}
+
+// the w pass runs across rows, the h and d passes across the contiguous x of a slice or row
+static void dct_block(coeff* block, int w, int h, int d, ptrdiff_t ystride, ptrdiff_t zstride, bool inverse) {
+	for(int z = 0; z < d; z++)
+		dct_pass(block+z*zstride,w,1,h,ystride,inverse);
+	for(int z = 0; z < d; z++)
+		dct_pass(block+z*zstride,h,ystride,w,1,inverse);
+	for(int y = 0; y < h; y++)
+		dct_pass(block+y*ystride,d,zstride,w,1,inverse);
+}
+
+void motion_dct_forward(coeff* block, int w, int h, int d, ptrdiff_t ystride, ptrdiff_t zstride) {
+	dct_block(block,w,h,d,ystride,zstride,false);
+}
+
+void motion_dct_inverse(coeff* block, int w, int h, int d, ptrdiff_t ystride, ptrdiff_t zstride) {
+	dct_block(block,w,h,d,ystride,zstride,true);
+}
+
+// The integer transform factors the orthonormal DCT-II of size N into a butterfly stage that splits it into a DCT-II
+// and a DCT-IV of size N/2, recursively for the DCT-II, and Givens rotations for the DCT-IV. Each rotation is three
+// lifting steps in 2.14 fixed point, which round but are undone exactly by subtracting the same amounts in reverse.
+#define LIFT_BITS 14
+#define LIFT_ROUND (1 << (LIFT_BITS-1))
+typedef int32_t ilanes[LANES];
+
+// j < 0 negates i, otherwise i += p*j, j += u*i, i += p*j
+struct intdct_op {
+	int8_t i, j;
+	int32_t p, u;
+};
+
+struct intdct_program {
+	int nops;
+	struct intdct_op ops[160];
+	// coefficient k ends up in out[k]
+	int8_t out[16];
+};
+
+// by log2 of the size
+static struct intdct_program programs[5];
+
+static void emit_negate(struct intdct_program* prog, int i) {
+	prog->ops[prog->nops++] = (struct intdct_op){i,-1,0,0};
+}
+
+// (x_i,x_j) -> (c*x_i - s*x_j, s*x_i + c*x_j)
+static void emit_rotation(struct intdct_program* prog, int i, int j, double c, double s) {
+	// a half turn is a negation of both, which keeps the lifting coefficients within [-1,1]
+	if(c < 0) {
+		emit_negate(prog,i);
+		emit_negate(prog,j);
+		c = -c;
+		s = -s;
+	}
+	if(fabs(s) < 1e-12)
+		return;
+	prog->ops[prog->nops++] = (struct intdct_op){i,j,lround((c-1)/s*(1 << LIFT_BITS)),lround(s*(1 << LIFT_BITS))};
+}
+
+// orthonormal DCT-IV of the m elements at idx, as the transposes of the rotations that reduce its matrix to a diagonal
+static void emit_dct4(struct intdct_program* prog, const int8_t* idx, int m) {
+	double q[8][8];
+	struct intdct_rotation { int i, j; double c, s; } rots[28];
+	int nrots = 0;
+	for(int k = 0; k < m; k++)
+		for(int n = 0; n < m; n++)
+			q[k][n] = sqrt(2.0/m)*cos(M_PI*(k+0.5)*(n+0.5)/m);
+	for(int col = 0; col < m; col++)
+		for(int j = col+1; j < m; j++) {
+			double a = q[col][col], b = q[j][col], r = hypot(a,b);
+			if(fabs(b) < 1e-15)
+				continue;
+			double c = a/r, s = b/r;
+			for(int n = 0; n < m; n++) {
+				double x = q[col][n], y = q[j][n];
+				q[col][n] = c*x+s*y;
+				q[j][n] = -s*x+c*y;
+			}
+			rots[nrots++] = (struct intdct_rotation){col,j,c,s};
+		}
+	for(int n = 0; n < m; n++)
+		if(q[n][n] < 0)
+			emit_negate(prog,idx[n]);
+	while(nrots--)
+		emit_rotation(prog,idx[rots[nrots].i],idx[rots[nrots].j],rots[nrots].c,rots[nrots].s);
+}
+
+// orthonormal DCT-II of the n elements at idx, writing where each coefficient ends up to out
+static void emit_dct2(struct intdct_program* prog, const int8_t* idx, int n, int8_t* out) {
+	if(n == 1) {
+		out[0] = idx[0];
+		return;
+	}
+	const int m = n/2;
+	int8_t even[8] = {0}, odd[8] = {0}, evenout[8];
+	// normalized butterflies, (x+y)/sqrt(2) and (x-y)/sqrt(2), as a rotation followed by a negation
+	for(int k = 0; k < m; k++) {
+		emit_rotation(prog,idx[k],idx[n-1-k],M_SQRT1_2,-M_SQRT1_2);
+		emit_negate(prog,idx[n-1-k]);
+		even[k] = idx[k];
+		odd[k] = idx[n-1-k];
+	}
+	emit_dct2(prog,even,m,evenout);
+	emit_dct4(prog,odd,m);
+	for(int k = 0; k < m; k++) {
+		out[2*k] = evenout[k];
+		out[2*k+1] = odd[k];
+	}
+}
+
+void motion_intdct_init(void) {
+	for(int l = 1; l < 5; l++) {
+		int8_t idx[16];
+		for(int k = 0; k < 1 << l; k++)
+			idx[k] = k;
+		programs[l].nops = 0;
+		emit_dct2(programs+l,idx,1 << l,programs[l].out);
+	}
+}
+
+static inline void lift(int32_t* restrict x, const int32_t* restrict y, int32_t c, bool inverse) {
+	for(int l = 0; l < LANES; l++) {
+		int32_t d = (c*y[l]+LIFT_ROUND) >> LIFT_BITS;
+		x[l] = inverse ? x[l]-d : x[l]+d;
+	}
+}
+
+static void intdct_pass(int32_t* data, int n, ptrdiff_t stride, size_t count, ptrdiff_t lanestride, bool inverse) {
+	if(n == 1)
+		return;
+	const struct intdct_program* prog = programs+__builtin_ctz(n);
+	ilanes x[16];
+	for(size_t l0 = 0; l0 < count; l0 += LANES) {
+		const size_t nl = MIN(LANES,count-l0);
+		int32_t* base = data+l0*lanestride;
+		for(int k = 0; k < n; k++) {
+			int8_t to = inverse ? prog->out[k] : k;
+			for(size_t l = 0; l < nl; l++)
+				x[to][l] = base[k*stride+l*lanestride];
+			for(size_t l = nl; l < LANES; l++)
+				x[to][l] = 0;
+		}
+		for(int o = 0; o < prog->nops; o++) {
+			const struct intdct_op op = prog->ops[inverse ? prog->nops-1-o : o];
+			if(op.j < 0)
+				for(int l = 0; l < LANES; l++)
+					x[op.i][l] = -x[op.i][l];
+			else if(inverse) {
+				lift(x[op.i],x[op.j],op.p,true);
+				lift(x[op.j],x[op.i],op.u,true);
+				lift(x[op.i],x[op.j],op.p,true);
+			}
+			else {
+				lift(x[op.i],x[op.j],op.p,false);
+				lift(x[op.j],x[op.i],op.u,false);
+				lift(x[op.i],x[op.j],op.p,false);
+			}
+		}
+		for(int k = 0; k < n; k++) {
+			int8_t from = inverse ? k : prog->out[k];
+			for(size_t l = 0; l < nl; l++)
+				base[k*stride+l*lanestride] = x[from][l];
+		}
+	}
+}
+
+void motion_intdct_forward(int32_t* block, int w, int h, int d, ptrdiff_t ystride, ptrdiff_t zstride) {
+	for(int z = 0; z < d; z++)
+		intdct_pass(block+z*zstride,w,1,h,ystride,false);
+	for(int z = 0; z < d; z++)
+		intdct_pass(block+z*zstride,h,ystride,w,1,false);
+	for(int y = 0; y < h; y++)
+		intdct_pass(block+y*ystride,d,zstride,w,1,false);
+}
+
+// the passes have to be undone in the opposite order for the rounding to cancel
+void motion_intdct_inverse(int32_t* block, int w, int h, int d, ptrdiff_t ystride, ptrdiff_t zstride) {
+	for(int y = 0; y < h; y++)
+		intdct_pass(block+y*ystride,d,zstride,w,1,true);
+	for(int z = 0; z < d; z++)
+		intdct_pass(block+z*zstride,h,ystride,w,1,true);
+	for(int z = 0; z < d; z++)
+		intdct_pass(block+z*zstride,w,1,h,ystride,true);
+}
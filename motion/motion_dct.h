@@ -0,0 +1,27 @@
+/*
+ * motion - apply various 2- or 3-dimensional frequency-domain operations to an image or video.
+ */
+
+#ifndef MOTION_DCT_H
+#define MOTION_DCT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "precision.h"
+
+// fixed-size separable DCT kernels for blocks whose dimensions are each 1, 2, 4, 8, or 16
+// scaled like FFTW's REDFT10 (forward) and REDFT01 (inverse) so they can stand in for an r2r plan
+// blocks are laid out with rows ystride apart and slices zstride apart, and transformed in place
+void motion_dct_init(void);
+bool motion_dct_supported(int w, int h, int d);
+void motion_dct_forward(coeff* block, int w, int h, int d, ptrdiff_t ystride, ptrdiff_t zstride);
+void motion_dct_inverse(coeff* block, int w, int h, int d, ptrdiff_t ystride, ptrdiff_t zstride);
+
+// reversible integer approximation of the orthonormal DCT-II for the same block dimensions, built from rounded lifting steps
+// so the inverse reproduces the forward transform's input exactly; magnitudes must stay within those of 8-bit pels
+void motion_intdct_init(void);
+void motion_intdct_forward(int32_t* block, int w, int h, int d, ptrdiff_t ystride, ptrdiff_t zstride);
+void motion_intdct_inverse(int32_t* block, int w, int h, int d, ptrdiff_t ystride, ptrdiff_t zstride);
+
+#endif
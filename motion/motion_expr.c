@@ -0,0 +1,504 @@
+/*
+ * motion - apply various 2- or 3-dimensional frequency-domain operations to an image or video.
+ */
+
+#include "motion_expr.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+enum expr_op {
+	// unary
+	op_neg, op_sinh, op_cosh, op_tanh, op_sin, op_cos, op_tan, op_atan, op_asin, op_acos, op_exp, op_log, op_abs,
+	op_squish, op_gauss, op_isnan, op_isinf, op_floor, op_ceil, op_trunc, op_round, op_sqrt, op_not, op_sgn,
+	// binary
+	op_add, op_mul, op_div, op_pow, op_mod, op_max, op_min, op_eq, op_gte, op_gt, op_lte, op_lt,
+	op_hypot, op_atan2, op_bitand, op_bitor,
+	// ternary
+	op_if, op_ifnot, op_between, op_clip, op_lerp
+};
+
+// functions callable by name, nargs < 0 means the last argument is optional
+static const struct {
+	const char* name;
+	enum expr_op op;
+	int nargs;
+} functions[] = {
+	{"sinh",op_sinh,1},{"cosh",op_cosh,1},{"tanh",op_tanh,1},{"sin",op_sin,1},{"cos",op_cos,1},{"tan",op_tan,1},
+	{"atan",op_atan,1},{"asin",op_asin,1},{"acos",op_acos,1},{"exp",op_exp,1},{"log",op_log,1},{"abs",op_abs,1},
+	{"squish",op_squish,1},{"gauss",op_gauss,1},{"isnan",op_isnan,1},{"isinf",op_isinf,1},{"floor",op_floor,1},
+	{"ceil",op_ceil,1},{"trunc",op_trunc,1},{"round",op_round,1},{"sqrt",op_sqrt,1},{"not",op_not,1},{"sgn",op_sgn,1},
+	{"mod",op_mod,2},{"max",op_max,2},{"min",op_min,2},{"eq",op_eq,2},{"gte",op_gte,2},{"gt",op_gt,2},{"lte",op_lte,2},
+	{"lt",op_lt,2},{"pow",op_pow,2},{"hypot",op_hypot,2},{"atan2",op_atan2,2},{"bitand",op_bitand,2},{"bitor",op_bitor,2},
+	{"if",op_if,-3},{"ifnot",op_ifnot,-3},{"between",op_between,3},{"clip",op_clip,3},{"lerp",op_lerp,3},
+};
+
+static const struct {
+	const char* name;
+	double value;
+} constants[] = {
+	{"E",M_E},{"PI",M_PI},{"PHI",1.61803398874989484820},{"QP2LAMBDA",118},
+};
+
+struct expr_reg {
+	bool vector, constant;
+	double value;
+	uint64_t depends; // variables the register's value depends on
+};
+
+struct expr_insn {
+	enum expr_op op;
+	int dst, arg[3];
+};
+
+struct motion_expr {
+	int nvars, nregs, ninsns, result;
+	struct expr_reg* regs;
+	struct expr_insn* insns;
+};
+
+struct parser {
+	const char* s;
+	const char* const* names;
+	struct motion_expr* e;
+	int regcap, insncap;
+};
+
+static void exec_op(enum expr_op op, double* restrict d, size_t n,
+                    const double* restrict a, size_t sa, const double* restrict b, size_t sb, const double* restrict c, size_t sc) {
+	#define MAP1(f) for(size_t j = 0; j < n; j++) { double x = a[j*sa]; d[j] = (f); } break
+	#define MAP2(f) for(size_t j = 0; j < n; j++) { double x = a[j*sa], y = b[j*sb]; d[j] = (f); } break
+	#define MAP3(f) for(size_t j = 0; j < n; j++) { double x = a[j*sa], y = b[j*sb], z = c[j*sc]; d[j] = (f); } break
+	switch(op) {
+		case op_neg:     MAP1(-x);
+		case op_sinh:    MAP1(sinh(x));
+		case op_cosh:    MAP1(cosh(x));
+		case op_tanh:    MAP1(tanh(x));
+		case op_sin:     MAP1(sin(x));
+		case op_cos:     MAP1(cos(x));
+		case op_tan:     MAP1(tan(x));
+		case op_atan:    MAP1(atan(x));
+		case op_asin:    MAP1(asin(x));
+		case op_acos:    MAP1(acos(x));
+		case op_exp:     MAP1(exp(x));
+		case op_log:     MAP1(log(x));
+		case op_abs:     MAP1(fabs(x));
+		case op_squish:  MAP1(1/(1+exp(4*x)));
+		case op_gauss:   MAP1(exp(-x*x/2)/sqrt(2*M_PI));
+		case op_isnan:   MAP1(!!isnan(x));
+		case op_isinf:   MAP1(!!isinf(x));
+		case op_floor:   MAP1(floor(x));
+		case op_ceil:    MAP1(ceil(x));
+		case op_trunc:   MAP1(trunc(x));
+		case op_round:   MAP1(round(x));
+		case op_sqrt:    MAP1(sqrt(x));
+		case op_not:     MAP1(x == 0);
+		case op_sgn:     MAP1((x > 0) - (x < 0));
+		case op_add:     MAP2(x + y);
+		case op_mul:     MAP2(x * y);
+		case op_div:     MAP2(x / y);
+		case op_pow:     MAP2(pow(x,y));
+		case op_mod:     MAP2(x - floor(x / y) * y);
+		case op_max:     MAP2(x > y ? x : y);
+		case op_min:     MAP2(x < y ? x : y);
+		case op_eq:      MAP2(x == y);
+		case op_gte:     MAP2(x >= y);
+		case op_gt:      MAP2(x > y);
+		case op_lte:     MAP2(x <= y);
+		case op_lt:      MAP2(x < y);
+		case op_hypot:   MAP2(hypot(x,y));
+		case op_atan2:   MAP2(atan2(x,y));
+		case op_bitand:  MAP2(isnan(x) || isnan(y) ? NAN : (double)((long)x & (long)y));
+		case op_bitor:   MAP2(isnan(x) || isnan(y) ? NAN : (double)((long)x | (long)y));
+		// both branches are always evaluated, which is safe since nothing supported has side effects
+		case op_if:      MAP3(x ? y : z);
+		case op_ifnot:   MAP3(!x ? y : z);
+		case op_between: MAP3(x >= y && x <= z);
+		case op_clip:    MAP3(isnan(x) || isnan(y) || isnan(z) || y > z ? NAN : x < y ? y : x > z ? z : x);
+		case op_lerp:    MAP3(x + (y - x) * z);
+	}
+	#undef MAP1
+	#undef MAP2
+	#undef MAP3
+}
+
+static int new_reg(struct parser* p, bool vector, bool constant, double value) {
+	struct motion_expr* e = p->e;
+	if(e->nregs == p->regcap) {
+		p->regcap = p->regcap ? p->regcap*2 : 32;
+		struct expr_reg* regs = realloc(e->regs,sizeof(*regs)*p->regcap);
+		if(!regs)
+			return -1;
+		e->regs = regs;
+	}
+	e->regs[e->nregs] = (struct expr_reg){vector,constant,value,0};
+	return e->nregs++;
+}
+
+// emit an instruction, folding it away when all of its arguments are constant
+static int emit(struct parser* p, enum expr_op op, int a, int b, int c) {
+	struct motion_expr* e = p->e;
+	int args[3] = {a,b,c};
+	bool vector = false, constant = true;
+	for(int i = 0; i < 3; i++) {
+		if(args[i] < 0)
+			continue;
+		vector |= e->regs[args[i]].vector;
+		constant &= e->regs[args[i]].constant;
+	}
+	if(constant) {
+		double v[3], d;
+		for(int i = 0; i < 3; i++)
+			v[i] = args[i] < 0 ? 0 : e->regs[args[i]].value;
+		exec_op(op,&d,1,v,0,v+1,0,v+2,0);
+		return new_reg(p,false,true,d);
+	}
+	int dst = new_reg(p,vector,false,0);
+	if(dst < 0)
+		return -1;
+	for(int i = 0; i < 3; i++)
+		if(args[i] >= 0)
+			e->regs[dst].depends |= e->regs[args[i]].depends;
+	if(e->ninsns == p->insncap) {
+		p->insncap = p->insncap ? p->insncap*2 : 32;
+		struct expr_insn* insns = realloc(e->insns,sizeof(*insns)*p->insncap);
+		if(!insns)
+			return -1;
+		e->insns = insns;
+	}
+	e->insns[e->ninsns++] = (struct expr_insn){op,dst,{a,b,c}};
+	return dst;
+}
+
+// same rule as FFmpeg's strmatch, the name must not continue as an identifier
+static bool match(const char* s, const char* name) {
+	size_t len = strlen(name);
+	return !strncmp(s,name,len) && !(isalnum((unsigned char)s[len]) || s[len] == '_');
+}
+
+static int parse_expr(struct parser* p);
+
+static int parse_primary(struct parser* p) {
+	char* next;
+	double d;
+	if(p->s[0] == '0' && (p->s[1]|0x20) == 'x')
+		d = strtoul(p->s,&next,16);
+	else
+		d = strtod(p->s,&next);
+	if(next != p->s) {
+		// SI prefixes and dB postfixes are left to av_expr_eval
+		if(isalpha((unsigned char)*next))
+			return -1;
+		p->s = next;
+		return new_reg(p,false,true,d);
+	}
+
+	for(int i = 0; p->names[i]; i++)
+		if(match(p->s,p->names[i])) {
+			p->s += strlen(p->names[i]);
+			return i;
+		}
+	for(size_t i = 0; i < sizeof(constants)/sizeof(*constants); i++)
+		if(match(p->s,constants[i].name)) {
+			p->s += strlen(constants[i].name);
+			return new_reg(p,false,true,constants[i].value);
+		}
+
+	const char* paren = strchr(p->s,'(');
+	if(!paren)
+		return -1;
+	const char* name = p->s;
+	size_t namelen = paren - name;
+	p->s = paren+1;
+	if(!namelen) {
+		int r = parse_expr(p);
+		if(r < 0 || *p->s != ')')
+			return -1;
+		p->s++;
+		return r;
+	}
+
+	int args[3] = {-1,-1,-1}, nargs = 0;
+	do {
+		if(nargs == 3 || (args[nargs++] = parse_expr(p)) < 0)
+			return -1;
+	} while(*p->s == ',' && p->s++);
+	if(*p->s != ')')
+		return -1;
+	p->s++;
+
+	for(size_t i = 0; i < sizeof(functions)/sizeof(*functions); i++) {
+		if(strlen(functions[i].name) != namelen || strncmp(functions[i].name,name,namelen))
+			continue;
+		int want = abs(functions[i].nargs);
+		if(nargs != want && !(functions[i].nargs < 0 && nargs == want-1))
+			return -1;
+		// a missing else branch evaluates to 0
+		if(nargs < want && (args[want-1] = new_reg(p,false,true,0)) < 0)
+			return -1;
+		return emit(p,functions[i].op,args[0],args[1],args[2]);
+	}
+	return -1;
+}
+
+static int parse_pow(struct parser* p, int* sign) {
+	*sign = (*p->s == '+') - (*p->s == '-');
+	p->s += *sign&1;
+	return parse_primary(p);
+}
+
+static int parse_factor(struct parser* p) {
+	int sign, sign2;
+	int r = parse_pow(p,&sign);
+	while(r >= 0 && *p->s == '^') {
+		p->s++;
+		int r2 = parse_pow(p,&sign2);
+		if(r2 >= 0 && sign2 < 0)
+			r2 = emit(p,op_neg,r2,-1,-1);
+		r = r2 < 0 ? -1 : emit(p,op_pow,r,r2,-1);
+	}
+	if(r >= 0 && sign < 0)
+		r = emit(p,op_neg,r,-1,-1);
+	return r;
+}
+
+static int parse_term(struct parser* p) {
+	int r = parse_factor(p);
+	while(r >= 0 && (*p->s == '*' || *p->s == '/')) {
+		enum expr_op op = *p->s++ == '*' ? op_mul : op_div;
+		int r2 = parse_factor(p);
+		r = r2 < 0 ? -1 : emit(p,op,r,r2,-1);
+	}
+	return r;
+}
+
+static int parse_subexpr(struct parser* p) {
+	int r = parse_term(p);
+	// the sign is consumed as part of the following term
+	while(r >= 0 && (*p->s == '+' || *p->s == '-')) {
+		int r2 = parse_term(p);
+		r = r2 < 0 ? -1 : emit(p,op_add,r,r2,-1);
+	}
+	return r;
+}
+
+static int parse_expr(struct parser* p) {
+	int r = parse_subexpr(p);
+	// without side effects only the last expression matters
+	while(r >= 0 && *p->s == ';') {
+		p->s++;
+		r = parse_subexpr(p);
+	}
+	return r;
+}
+
+struct motion_expr* motion_expr_compile(const char* expr, const char* const* names, uint64_t vectors) {
+	struct motion_expr* e = calloc(1,sizeof(*e));
+	char* s = malloc(strlen(expr)+1);
+	if(!e || !s)
+		goto fail;
+
+	// FFmpeg ignores whitespace anywhere in an expression
+	char* w = s;
+	for(const char* r = expr; *r; r++)
+		if(!strchr(" \t\n\r\f\v",*r))
+			*w++ = *r;
+	*w = '\0';
+
+	struct parser p = { .s = s, .names = names, .e = e };
+	for(; names[e->nvars]; e->nvars++) {
+		if(new_reg(&p,(vectors >> e->nvars) & 1,false,0) < 0)
+			goto fail;
+		e->regs[e->nvars].depends = 1ull << e->nvars;
+	}
+
+	e->result = parse_expr(&p);
+	if(e->result < 0 || *p.s)
+		goto fail;
+	free(s);
+	return e;
+
+fail:
+	free(s);
+	motion_expr_free(e);
+	return NULL;
+}
+
+void motion_expr_free(struct motion_expr* e) {
+	if(!e)
+		return;
+	free(e->regs);
+	free(e->insns);
+	free(e);
+}
+
+size_t motion_expr_scratch(const struct motion_expr* e, size_t n) {
+	size_t len = 0;
+	for(int r = e->nvars; r < e->nregs; r++)
+		len += e->regs[r].vector ? n : 1;
+	return len;
+}
+
+void motion_expr_eval(const struct motion_expr* e, const double* vals, const double* const* vectors, size_t n, double* scratch, double* out) {
+	double* regs[e->nregs];
+	for(int r = 0; r < e->nregs; r++) {
+		const struct expr_reg* reg = e->regs+r;
+		if(r < e->nvars)
+			regs[r] = (double*)(reg->vector ? vectors[r] : vals+r);
+		else {
+			regs[r] = scratch;
+			scratch += reg->vector ? n : 1;
+			if(reg->constant)
+				*regs[r] = reg->value;
+		}
+	}
+
+	for(int i = 0; i < e->ninsns; i++) {
+		const struct expr_insn* insn = e->insns+i;
+		const double* args[3] = {NULL,NULL,NULL};
+		size_t strides[3] = {0,0,0};
+		for(int a = 0; a < 3; a++)
+			if(insn->arg[a] >= 0) {
+				args[a] = regs[insn->arg[a]];
+				strides[a] = e->regs[insn->arg[a]].vector;
+			}
+		exec_op(insn->op,regs[insn->dst],e->regs[insn->dst].vector ? n : 1,args[0],strides[0],args[1],strides[1],args[2],strides[2]);
+	}
+
+	const double* result = regs[e->result];
+	if(e->regs[e->result].vector)
+		memcpy(out,result,sizeof(*out)*n);
+	else
+		for(size_t j = 0; j < n; j++)
+			out[j] = *result;
+}
+
+// mark which registers are affine functions of var, returns whether the result is
+static bool find_affine(const struct motion_expr* e, int var, bool* affine) {
+	const uint64_t v = 1ull << var;
+	for(int r = 0; r < e->nregs; r++)
+		affine[r] = r == var;
+	for(int i = 0; i < e->ninsns; i++) {
+		const struct expr_insn* insn = e->insns+i;
+		const int* a = insn->arg;
+		#define FREE(r) (!(e->regs[r].depends & v))
+		#define AFF(r) (affine[r] || FREE(r))
+		switch(insn->op) {
+			case op_neg: affine[insn->dst] = AFF(a[0]); break;
+			case op_add: affine[insn->dst] = AFF(a[0]) && AFF(a[1]); break;
+			case op_mul: affine[insn->dst] = (AFF(a[0]) && FREE(a[1])) || (FREE(a[0]) && AFF(a[1])); break;
+			case op_div: affine[insn->dst] = AFF(a[0]) && FREE(a[1]); break;
+			case op_if:
+			case op_ifnot: affine[insn->dst] = FREE(a[0]) && AFF(a[1]) && AFF(a[2]); break;
+			case op_lerp: affine[insn->dst] = AFF(a[0]) && AFF(a[1]) && FREE(a[2]); break;
+			default: break;
+		}
+		// only registers that actually depend on var carry a derivative
+		affine[insn->dst] &= !FREE(insn->dst);
+		#undef FREE
+		#undef AFF
+	}
+	return affine[e->result] || !(e->regs[e->result].depends & v);
+}
+
+bool motion_expr_affine(const struct motion_expr* e, int var, uint64_t* depends) {
+	bool affine[e->nregs];
+	if(!find_affine(e,var,affine))
+		return false;
+	*depends = e->regs[e->result].depends & ~(1ull << var);
+	return true;
+}
+
+size_t motion_expr_affine_scratch(const struct motion_expr* e, size_t n) {
+	return motion_expr_scratch(e,n) + (size_t)e->nregs*n + n;
+}
+
+void motion_expr_eval_affine(const struct motion_expr* e, int var, const double* vals, const double* const* vectors, size_t n, double* scratch, double* gain, double* offset) {
+	bool affine[e->nregs];
+	find_affine(e,var,affine);
+
+	// values are evaluated with var at 0, giving the offset, while the derivatives alongside them give the gain
+	double* zero = scratch;
+	scratch += n;
+	memset(zero,0,sizeof(*zero)*n);
+	const double* vars[e->nvars];
+	for(int r = 0; r < e->nvars; r++)
+		vars[r] = r == var ? zero : vectors[r];
+
+	double* regs[e->nregs],* deriv[e->nregs];
+	for(int r = 0; r < e->nregs; r++) {
+		const struct expr_reg* reg = e->regs+r;
+		if(r == var)
+			regs[r] = zero;
+		else if(r < e->nvars)
+			regs[r] = (double*)(reg->vector ? vars[r] : vals+r);
+		else {
+			regs[r] = scratch;
+			scratch += reg->vector ? n : 1;
+			if(reg->constant)
+				*regs[r] = reg->value;
+		}
+	}
+	for(int r = 0; r < e->nregs; r++)
+		if(r == var) {
+			deriv[r] = scratch;
+			for(size_t j = 0; j < n; j++)
+				deriv[r][j] = 1;
+			scratch += n;
+		}
+		else if(affine[r]) {
+			deriv[r] = scratch;
+			scratch += n;
+		}
+		else deriv[r] = zero;
+
+	for(int i = 0; i < e->ninsns; i++) {
+		const struct expr_insn* insn = e->insns+i;
+		const int* a = insn->arg;
+		const double* args[3] = {NULL,NULL,NULL};
+		size_t strides[3] = {0,0,0};
+		for(int k = 0; k < 3; k++)
+			if(a[k] >= 0) {
+				args[k] = regs[a[k]];
+				strides[k] = e->regs[a[k]].vector;
+			}
+		exec_op(insn->op,regs[insn->dst],e->regs[insn->dst].vector ? n : 1,args[0],strides[0],args[1],strides[1],args[2],strides[2]);
+
+		if(!affine[insn->dst])
+			continue;
+		double* d = deriv[insn->dst];
+		switch(insn->op) {
+			case op_neg:
+			case op_add:
+				exec_op(insn->op,d,n,deriv[a[0]],1,a[1] < 0 ? NULL : deriv[a[1]],1,NULL,0);
+				break;
+			case op_mul:
+				// only one side depends on var
+				if(affine[a[0]])
+					exec_op(op_mul,d,n,deriv[a[0]],1,regs[a[1]],strides[1],NULL,0);
+				else
+					exec_op(op_mul,d,n,regs[a[0]],strides[0],deriv[a[1]],1,NULL,0);
+				break;
+			case op_div:
+				exec_op(op_div,d,n,deriv[a[0]],1,regs[a[1]],strides[1],NULL,0);
+				break;
+			case op_if:
+			case op_ifnot:
+				exec_op(insn->op,d,n,regs[a[0]],strides[0],deriv[a[1]],1,deriv[a[2]],1);
+				break;
+			case op_lerp:
+				exec_op(op_lerp,d,n,deriv[a[0]],1,deriv[a[1]],1,regs[a[2]],strides[2]);
+				break;
+			default: break;
+		}
+	}
+
+	const struct expr_reg* result = e->regs+e->result;
+	for(size_t j = 0; j < n; j++) {
+		offset[j] = regs[e->result][result->vector ? j : 0];
+		gain[j] = deriv[e->result][j];
+	}
+}
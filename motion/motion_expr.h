@@ -0,0 +1,32 @@
+/*
+ * motion - apply various 2- or 3-dimensional frequency-domain operations to an image or video.
+ */
+
+#ifndef MOTION_EXPR_H
+#define MOTION_EXPR_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// compiles FFmpeg expression syntax into register bytecode evaluated a whole row at a time
+// variables whose bit is set in vectors vary along the row, the rest are constant across it
+// returns NULL when the expression uses anything the compiler doesn't handle (st/ld, random, SI suffixes, etc.)
+// so the caller can fall back to av_expr_eval
+struct motion_expr;
+struct motion_expr* motion_expr_compile(const char* expr, const char* const* names, uint64_t vectors);
+void motion_expr_free(struct motion_expr*);
+
+// number of doubles of scratch needed to evaluate rows of width n
+size_t motion_expr_scratch(const struct motion_expr*, size_t n);
+
+// scalar variables are read from vals, vector variables from vectors[index]
+void motion_expr_eval(const struct motion_expr*, const double* vals, const double* const* vectors, size_t n, double* scratch, double* out);
+
+// whether the expression is of the form gain*var+offset, with depends set to the other variables gain and offset depend on
+bool motion_expr_affine(const struct motion_expr*, int var, uint64_t* depends);
+size_t motion_expr_affine_scratch(const struct motion_expr*, size_t n);
+// evaluate the gain and offset of an affine expression along a row, the value of var in vals/vectors is ignored
+void motion_expr_eval_affine(const struct motion_expr*, int var, const double* vals, const double* const* vectors, size_t n, double* scratch, double* gain, double* offset);
+
+#endif
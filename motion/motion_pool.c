@@ -0,0 +1,131 @@
+/*
+ * motion - apply various 2- or 3-dimensional frequency-domain operations to an image or video.
+ */
+
+#include "motion_pool.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+struct motion_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t start, done;
+	pthread_t* threads;
+	int nthreads;
+
+	// current batch
+	unsigned long generation;
+	motion_pool_job* job;
+	void* arg;
+	size_t njobs, next, pending;
+	int running;
+	bool quit;
+};
+
+struct motion_pool_worker {
+	struct motion_pool* pool;
+	int index;
+};
+
+// take jobs from the current batch until there are none left, called with the lock held
+static void run_jobs(struct motion_pool* pool, int worker) {
+	while(pool->next < pool->njobs) {
+		size_t job = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		pool->job(pool->arg,job,worker);
+		pthread_mutex_lock(&pool->lock);
+		pool->pending--;
+	}
+}
+
+static void* worker_main(void* arg) {
+	struct motion_pool_worker* self = arg;
+	struct motion_pool* pool = self->pool;
+	int index = self->index;
+	free(self);
+
+	unsigned long generation = 0;
+	pthread_mutex_lock(&pool->lock);
+	for(;;) {
+		while(!pool->quit && pool->generation == generation)
+			pthread_cond_wait(&pool->start,&pool->lock);
+		if(pool->quit)
+			break;
+		generation = pool->generation;
+		pool->running++;
+		run_jobs(pool,index);
+		if(!--pool->running && !pool->pending)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+struct motion_pool* motion_pool_create(int nthreads) {
+	struct motion_pool* pool = calloc(1,sizeof(*pool));
+	if(!pool)
+		return NULL;
+	if(nthreads < 1)
+		nthreads = 1;
+	pthread_mutex_init(&pool->lock,NULL);
+	pthread_cond_init(&pool->start,NULL);
+	pthread_cond_init(&pool->done,NULL);
+	pool->nthreads = 1;
+	if(nthreads > 1 && !(pool->threads = malloc(sizeof(*pool->threads)*(nthreads-1)))) {
+		motion_pool_destroy(pool);
+		return NULL;
+	}
+	// the calling thread is always worker 0
+	for(int i = 1; i < nthreads; i++) {
+		struct motion_pool_worker* w = malloc(sizeof(*w));
+		if(!w)
+			break;
+		*w = (struct motion_pool_worker){pool,i};
+		if(pthread_create(pool->threads+i-1,NULL,worker_main,w)) {
+			free(w);
+			break;
+		}
+		pool->nthreads++;
+	}
+	return pool;
+}
+
+void motion_pool_destroy(struct motion_pool* pool) {
+	if(!pool)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+	for(int i = 0; i < pool->nthreads-1; i++)
+		pthread_join(pool->threads[i],NULL);
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool);
+}
+
+int motion_pool_threads(struct motion_pool* pool) {
+	return pool->nthreads;
+}
+
+void motion_pool_run(struct motion_pool* pool, size_t njobs, motion_pool_job* job, void* arg) {
+	if(pool->nthreads == 1 || njobs < 2) {
+		for(size_t i = 0; i < njobs; i++)
+			job(arg,i,0);
+		return;
+	}
+	pthread_mutex_lock(&pool->lock);
+	pool->job = job;
+	pool->arg = arg;
+	pool->njobs = pool->pending = njobs;
+	pool->next = 0;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+	run_jobs(pool,0);
+	while(pool->pending || pool->running)
+		pthread_cond_wait(&pool->done,&pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
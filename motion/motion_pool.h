@@ -0,0 +1,21 @@
+/*
+ * motion - apply various 2- or 3-dimensional frequency-domain operations to an image or video.
+ */
+
+#ifndef MOTION_POOL_H
+#define MOTION_POOL_H
+
+#include <stddef.h>
+
+// jobs are handed out in order to whichever worker is free; worker indexes are in [0,nthreads)
+typedef void (motion_pool_job)(void* arg, size_t job, int worker);
+
+struct motion_pool;
+struct motion_pool* motion_pool_create(int nthreads);
+void motion_pool_destroy(struct motion_pool*);
+int  motion_pool_threads(struct motion_pool*);
+
+// run njobs jobs across the pool and the calling thread, returning once all have finished
+void motion_pool_run(struct motion_pool*, size_t njobs, motion_pool_job*, void* arg);
+
+#endif
@@ -37,6 +37,7 @@ void help() {
 		"  -F <fmt>        FFmpeg output format name. [default: selected by FFmpeg based on output file extension]\n"
 		"  -c <optstring>  Option string specifying the pixel format and color properties to convert to for processing.\n"
 		"  -e <enc>        FFmpeg output encoder name. [default: FFV1 or selected by FFmpeg based on output format]\n"
+		"  -t <n[:type]>   FFmpeg decoding/encoding threads, type one of frame, slice, or auto. [default: auto:auto (one per core)]\n"
 		"  -l <int>        Integer FFmpeg log level. [default: 16 (AV_LOG_ERROR)]\n"
 	);
 	exit(0);
@@ -49,8 +50,9 @@ int main(int argc, char* argv[]) {
 	const char* iopt = NULL,* ifmt = NULL,* cprops = NULL;
 	const char* oopt = NULL,* ofmt = NULL,* enc = NULL;
 	int loglevel = AV_LOG_ERROR;
+	FFThreadConfig threads = {0};
 	int c;
-	while((c = getopt(argc,argv,"o:O:f:F:c:e:l:r:s:hq")) > 0)
+	while((c = getopt(argc,argv,"o:O:f:F:c:e:l:r:s:t:hq")) > 0)
 		switch(c) {
 			case 'o': iopt = optarg; break; case 'O': oopt = optarg; break;
 			case 'f': ifmt = optarg; break; case 'F': ofmt = optarg; break;
@@ -62,6 +64,11 @@ int main(int argc, char* argv[]) {
 					samedur = true;
 				else av_parse_video_rate(&fps,optarg);
 			}; break;
+			case 't':
+				if(ffapi_parse_threads(&threads, optarg)) {
+					fprintf(stderr,"invalid thread spec %s\n",optarg);
+					return 1;
+				}; break;
 			case 'q': quiet = true; break;
 			case 'h': help();
 			default: return 1;
@@ -98,7 +105,7 @@ int main(int argc, char* argv[]) {
 	FFColorProperties color_props;
 	ffapi_parse_color_props(&color_props, cprops);
 
-	FFContext* in = ffapi_open_input(argv[1],iopt,ifmt,&color_props,pix_fmt_filter,&components,&widths,&heights,&nframes,&r,frames == 0,&err);
+	FFContext* in = ffapi_open_input(argv[1],iopt,ifmt,&color_props,pix_fmt_filter,&components,&widths,&heights,&nframes,&r,frames == 0,&threads,&err);
 	if(!in) {
 		fprintf(stderr,"error opening input file %s: %s\n",argv[1],av_err2str(err));
 		return 1;
@@ -109,6 +116,11 @@ int main(int argc, char* argv[]) {
 		ffapi_close(in);
 		return 1;
 	}
+	if((err = ffapi_read_ahead(in,FFAPI_READ_AHEAD))) {
+		fprintf(stderr,"Error starting input thread: %s\n",av_err2str(err));
+		ffapi_close(in);
+		return 1;
+	}
 
 	if(nframes)
 		nframes -= offset;
@@ -125,11 +137,16 @@ int main(int argc, char* argv[]) {
 		else fps = r;
 	}
 
-	FFContext* out = ffapi_open_output(argv[2],oopt,ofmt,enc,AV_CODEC_ID_FFV1,&color_props,len[map[0]],len[map[1]],fps,&err);
+	FFContext* out = ffapi_open_output(argv[2],oopt,ofmt,enc,AV_CODEC_ID_FFV1,&color_props,len[map[0]],len[map[1]],fps,&threads,&err);
 	if(!out) {
 		fprintf(stderr,"error opening output file %s: %s\n",argv[2],av_err2str(err));
 		return 1;
 	}
+	if((err = ffapi_write_behind(out,FFAPI_WRITE_BEHIND))) {
+		fprintf(stderr,"error starting output thread: %s\n",av_err2str(err));
+		ffapi_close(out);
+		return 1;
+	}
 
 	AVFrame* iframe = ffapi_alloc_frame(in);
 	if(!iframe) { fprintf(stderr,"inframe error\n"); return 1; }
@@ -176,6 +193,9 @@ int main(int argc, char* argv[]) {
 end:
 	free(buf);
 	ffapi_free_frame(oframe);
-	ffapi_close(out);
+	if((err = ffapi_close(out)) && !ret) {
+		fprintf(stderr,"error finishing output file %s: %s\n",argv[2],av_err2str(err));
+		ret = 1;
+	}
 	return ret;
 }
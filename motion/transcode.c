@@ -21,6 +21,7 @@ void help() {
 		"  -F <fmt>        FFmpeg output format name. [default: selected by FFmpeg based on output file extension]\n"
 		"  -c <optstring>  Option string specifying the pixel format and color properties to convert to for processing.\n"
 		"  -e <enc>        FFmpeg output encoder name. [default: FFV1 or selected by FFmpeg based on output format]\n"
+		"  -t <n[:type]>   FFmpeg decoding/encoding threads, type one of frame, slice, or auto. [default: auto:auto (one per core)]\n"
 		"  -l <int>        Integer FFmpeg log level. [default: 16 (AV_LOG_ERROR)]\n"
 	);
 	exit(0);
@@ -32,9 +33,10 @@ int main(int argc, char* argv[]) {
 	const char* iopt = NULL,* ifmt = NULL,* cprops = NULL;
 	const char* oopt = NULL,* ofmt = NULL,* enc = NULL;
 	int loglevel = AV_LOG_ERROR;
+	FFThreadConfig threads = {0};
 	bool quiet = false;
 	int c;
-	while((c = getopt(argc, argv, "o:O:f:F:c:e:l:r:s:qh")) > 0)
+	while((c = getopt(argc, argv, "o:O:f:F:c:e:l:r:s:t:qh")) > 0)
 		switch(c) {
 			case 'o': iopt = optarg; break; case 'O': oopt = optarg; break;
 			case 'f': ifmt = optarg; break; case 'F': ofmt = optarg; break;
@@ -42,6 +44,11 @@ int main(int argc, char* argv[]) {
 			case 'l': loglevel = strtol(optarg, NULL, 10); break;
 			case 'r': av_parse_video_rate(&fps, optarg); break;
 			case 's': sscanf(optarg, "%" SCNu64 ":" "%" SCNu64, &offset, &frames); break;
+			case 't':
+				if(ffapi_parse_threads(&threads, optarg)) {
+					fprintf(stderr, "Invalid thread spec %s\n", optarg);
+					return 1;
+				}; break;
 			case 'q': quiet = true; break;
 			case 'h': help();
 			default: return 1;
@@ -66,19 +73,24 @@ int main(int argc, char* argv[]) {
 	FFColorProperties color_props;
 	ffapi_parse_color_props(&color_props, cprops);
 
-	in = ffapi_open_input(argv[0], iopt, ifmt, &color_props, ffapi_pixfmts_8bit_pel, &components, &widths, &heights, &nframes, (fps.den == 0 ? &fps : NULL), frames == 0, &err);
+	in = ffapi_open_input(argv[0], iopt, ifmt, &color_props, ffapi_pixfmts_8bit_pel, &components, &widths, &heights, &nframes, (fps.den == 0 ? &fps : NULL), frames == 0, &threads, &err);
 	if(!in) {
 		fprintf(stderr, "Error opening input context: %s\n",av_err2str(err));
 		ret = 1;
 		goto end;
 	}
 
-	out = ffapi_open_output(argv[1], oopt, ofmt, enc, AV_CODEC_ID_FFV1, &color_props, *widths, *heights, fps, &err);
+	out = ffapi_open_output(argv[1], oopt, ofmt, enc, AV_CODEC_ID_FFV1, &color_props, *widths, *heights, fps, &threads, &err);
 	if(!out) {
 		fprintf(stderr, "Error opening output context: %s\n",av_err2str(err));
 		ret = 1;
 		goto end;
 	 }
+	if((err = ffapi_write_behind(out, FFAPI_WRITE_BEHIND))) {
+		fprintf(stderr, "Error starting output thread: %s\n",av_err2str(err));
+		ret = 1;
+		goto end;
+	}
 
 	iframe = ffapi_alloc_frame(in);
 	if(!iframe) {
@@ -103,6 +115,11 @@ int main(int argc, char* argv[]) {
 		ret = 1;
 		goto end;
 	}
+	if((err = ffapi_read_ahead(in, FFAPI_READ_AHEAD))) {
+		fprintf(stderr,"Error starting input thread: %s\n",av_err2str(err));
+		ret = 1;
+		goto end;
+	}
 
 	for(uint64_t z = 0; z < nframes && !(err = ffapi_read_frame(in, iframe)); z++) {
 		// equivalent to ffapi_write_frame(out, iframe) since no image processing is being done
@@ -131,6 +148,9 @@ end:
 	ffapi_free_frame(iframe);
 	ffapi_close(in);
 	ffapi_free_frame(oframe);
-	ffapi_close(out);
+	if((err = ffapi_close(out)) && !ret) {
+		fprintf(stderr, "Error finishing output: %s\n",av_err2str(err));
+		ret = 1;
+	}
 	return ret;
 }
@@ -70,6 +70,7 @@ void help(bool fullhelp) {
 		"   --ff-rate <rate>        output framerate\n"
 		"   --ff-opts <optstring>   output av options string (k=v:...)\n"
 		"   --ff-loglevel <-8..64>  av loglevel\n"
+		"   --ff-threads <n[:type]> output encoder threads, type frame, slice, or auto [default: auto:auto]\n"
 		"\n"
 		"spec options:\n"
 		"   --spec-gain <float>      spectrogram log multiplier (with -s)\n"
@@ -122,6 +123,7 @@ int main(int argc, char* argv[]) {
 	AVRational fps = {20,1};
 	const char* oopt = NULL,* ofmt = NULL,* enc = NULL;
 	int loglevel = 0;
+	FFThreadConfig threads = {0};
 	const char* method = "diag",* scan_options = NULL,* serialized_scan = NULL;
 	size_t nframes = 0, offset = 0;
 	bool spec = false, invert = false, intermediates = false, linear = false, max_intermediates = false, visualize = false, fill_offset = true, quiet = false, measure_parity = false;
@@ -159,6 +161,7 @@ int main(int argc, char* argv[]) {
 		{"ff-encoder",required_argument,NULL,4},
 		{"ff-loglevel",required_argument,NULL,5},
 		{"ff-rate",required_argument,NULL,6},
+		{"ff-threads",required_argument,NULL,10},
 
 		// spec opts
 		{"spec-gain",required_argument,NULL,7},
@@ -203,6 +206,12 @@ int main(int argc, char* argv[]) {
 			case 4: enc  = optarg; break;
 			case 5: loglevel = strtol(optarg, NULL, 10); break;
 			case 6: av_parse_video_rate(&fps, optarg); break;
+			case 10: {
+				if(ffapi_parse_threads(&threads, optarg)) {
+					fprintf(stderr, "Invalid thread spec: %s\n", optarg);
+					exit(1);
+				}
+			} break;
 
 			case 7: gain = precision_strtoi(optarg,NULL); break;
 			case 8: {
@@ -323,12 +332,18 @@ int main(int argc, char* argv[]) {
 		goto scan_end;
 
 	int err;
-	FFContext* ffctx = ffapi_open_output(argv[1], oopt, ofmt, enc, AV_CODEC_ID_FFV1, &color_props, width*(!!visualize+1), height*(!!intermediates+1), fps, &err);
+	FFContext* ffctx = ffapi_open_output(argv[1], oopt, ofmt, enc, AV_CODEC_ID_FFV1, &color_props, width*(!!visualize+1), height*(!!intermediates+1), fps, &threads, &err);
 	if(!ffctx) {
 		ret = 1;
 		fprintf(stderr, "Error opening output context: %s\n",av_err2str(err));
 		goto scan_end;
 	}
+	if((err = ffapi_write_behind(ffctx, FFAPI_WRITE_BEHIND))) {
+		ret = 1;
+		fprintf(stderr, "Error starting output thread: %s\n",av_err2str(err));
+		ffapi_close(ffctx);
+		goto scan_end;
+	}
 	av_csp_trc_function trc_encode = NULL;
 	if(linear)
 		trc_encode = av_csp_trc_func_from_id(ffctx->codec->color_trc);
@@ -553,7 +568,10 @@ err:
 
 ffapi_end:
 	ffapi_free_frame(frame);
-	ffapi_close(ffctx);
+	if((err = ffapi_close(ffctx)) && !ret) {
+		ret = 1;
+		fprintf(stderr, "Error finishing output: %s\n",av_err2str(err));
+	}
 
 scan_end:
 	scan_destroy(scanctx);
@@ -109,6 +109,7 @@ static void help(const char* self) {
 		"   --ff-rate <rate>        output framerate\n"
 		"   --ff-opts <optstring>   output av options string (k=v:...)\n"
 		"   --ff-loglevel <-8..64>  av loglevel\n"
+		"   --ff-threads <n[:type]> output encoder threads, type frame, slice, or auto [default: auto:auto]\n"
 		"\n", self
 	);
 	exit(0);
@@ -128,6 +129,7 @@ int main(int argc, char* argv[]) {
 	AVRational fps = {60,1};
 	const char* oopt = NULL,* ofmt = NULL,* enc = NULL;
 	int loglevel = 0;
+	FFThreadConfig threads = {0};
 
 	const char* exprstrs[5] = {0};
 
@@ -143,6 +145,7 @@ int main(int argc, char* argv[]) {
 		{"ff-encoder",required_argument,NULL,5},
 		{"ff-loglevel",required_argument,NULL,6},
 		{"ff-rate",required_argument,NULL,7},
+		{"ff-threads",required_argument,NULL,8},
 		{0}
 	};
 
@@ -200,6 +203,7 @@ int main(int argc, char* argv[]) {
 			case 5: enc  = optarg; break;
 			case 6: loglevel = strtol(optarg, NULL, 10); break;
 			case 7: av_parse_video_rate(&fps, optarg); break;
+			case 8: if(ffapi_parse_threads(&threads, optarg)) usage(argv[0]); break;
 			default: usage(argv[0]);
 		}
 	}
@@ -303,11 +307,16 @@ int main(int argc, char* argv[]) {
 	}
 
 	int err;
-	FFContext* ffctx = ffapi_open_output(outfile, oopt, ofmt, enc, AV_CODEC_ID_FFV1, &color_props, vw, vh, fps, &err);
+	FFContext* ffctx = ffapi_open_output(outfile, oopt, ofmt, enc, AV_CODEC_ID_FFV1, &color_props, vw, vh, fps, &threads, &err);
 	if(!ffctx) {
 		fprintf(stderr,"Error opening output context: %s\n",av_err2str(err));
 		return 1;
 	}
+	if((err = ffapi_write_behind(ffctx, FFAPI_WRITE_BEHIND))) {
+		fprintf(stderr,"Error starting output thread: %s\n",av_err2str(err));
+		ffapi_close(ffctx);
+		return 1;
+	}
 
 	av_csp_trc_function trc_encode = gamma ? av_csp_trc_func_from_id(ffctx->codec->color_trc) : NULL;
 
@@ -420,7 +429,10 @@ err:
 
 	free(icoeffs);
 	ffapi_free_frame(frame);
-	ffapi_close(ffctx);
+	if((err = ffapi_close(ffctx)) && !ret) {
+		fprintf(stderr,"Error finishing output: %s\n",av_err2str(err));
+		ret = 1;
+	}
 
 end:
 	for(int i = 0; i < sizeof(exprstrs)/sizeof(*exprstrs); i++)